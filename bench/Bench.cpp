@@ -0,0 +1,296 @@
+#include "QuadTree.hpp"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <new>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+
+// Headless workloads for QuadTree: every run is seeded, so numbers are comparable between builds.
+// Usage: bench [max_items], max_items defaulting to 1000000 (item counts go 1k, 10k, ... up to it).
+
+static std::atomic<std::size_t> live_bytes(0);
+
+// Heap accounting for bytes per item. Every allocation carries its size in a header in front of it.
+static void* CountedAlloc(std::size_t size, std::size_t alignment)
+{
+	const std::size_t header = std::max(alignment, alignof(std::max_align_t));
+	const std::size_t total = (header + size + alignment - 1) / alignment * alignment;
+	char* block = static_cast<char*>(std::aligned_alloc(alignment, total));
+
+	if (block == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+
+	*reinterpret_cast<std::size_t*>(block + header - sizeof(std::size_t)) = size;
+	live_bytes.fetch_add(size, std::memory_order_relaxed);
+	return block + header;
+}
+
+static void CountedFree(void* ptr, std::size_t alignment)
+{
+	if (ptr == nullptr)
+	{
+		return;
+	}
+
+	const std::size_t header = std::max(alignment, alignof(std::max_align_t));
+	char* block = static_cast<char*>(ptr) - header;
+	live_bytes.fetch_sub(*reinterpret_cast<std::size_t*>(block + header - sizeof(std::size_t)), std::memory_order_relaxed);
+	std::free(block);
+}
+
+void* operator new(std::size_t size) { return CountedAlloc(size, alignof(std::max_align_t)); }
+void* operator new[](std::size_t size) { return CountedAlloc(size, alignof(std::max_align_t)); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return CountedAlloc(size, static_cast<std::size_t>(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return CountedAlloc(size, static_cast<std::size_t>(alignment)); }
+void operator delete(void* ptr) noexcept { CountedFree(ptr, alignof(std::max_align_t)); }
+void operator delete[](void* ptr) noexcept { CountedFree(ptr, alignof(std::max_align_t)); }
+void operator delete(void* ptr, std::size_t) noexcept { CountedFree(ptr, alignof(std::max_align_t)); }
+void operator delete[](void* ptr, std::size_t) noexcept { CountedFree(ptr, alignof(std::max_align_t)); }
+void operator delete(void* ptr, std::align_val_t alignment) noexcept { CountedFree(ptr, static_cast<std::size_t>(alignment)); }
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept { CountedFree(ptr, static_cast<std::size_t>(alignment)); }
+void operator delete(void* ptr, std::size_t, std::align_val_t alignment) noexcept { CountedFree(ptr, static_cast<std::size_t>(alignment)); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t alignment) noexcept { CountedFree(ptr, static_cast<std::size_t>(alignment)); }
+
+enum class Workload { UNIFORM, CLUSTERED, MIXED };
+
+struct Result
+{
+	double insert_ns_;
+	double remove_ns_;
+	double relocate_ns_;
+	double search_rect_ns_;
+	double search_circle_ns_;
+	double found_per_search_;
+	double bytes_per_item_;
+};
+
+static constexpr float world_size = 4096.0f;
+static constexpr std::size_t search_count = 2000;
+static constexpr std::size_t agent_steps = 4;
+
+// Keeps results alive so the optimizer cannot drop the work producing them.
+static volatile std::size_t sink = 0;
+
+static const char* WorkloadName(Workload workload)
+{
+	switch (workload)
+	{
+		case Workload::UNIFORM:
+			return "uniform";
+		case Workload::CLUSTERED:
+			return "clustered";
+		case Workload::MIXED:
+			return "mixed";
+	}
+
+	return "";
+}
+
+static double NsSince(std::chrono::steady_clock::time_point start, std::size_t ops)
+{
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return ops == 0 ? 0.0 : elapsed.count() / static_cast<double>(ops);
+}
+
+// Top-left corners stay inside the world, which is what Insert expects.
+static Rect<float> ClampedRect(float x, float y, float width, float height)
+{
+	return { std::clamp(x, 0.0f, world_size - 1.0f), std::clamp(y, 0.0f, world_size - 1.0f), width, height };
+}
+
+static std::vector<Rect<float>> Generate(Workload workload, std::size_t count, std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> position(0.0f, world_size);
+	std::uniform_real_distribution<float> small_side(1.0f, 8.0f);
+	std::uniform_real_distribution<float> large_side(64.0f, 512.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::normal_distribution<float> spread(0.0f, world_size * 0.02f);
+
+	std::array<Point<float>, 16> centers;
+
+	for (Point<float>& center : centers)
+	{
+		center = { position(rng), position(rng) };
+	}
+
+	std::vector<Rect<float>> rects;
+	rects.reserve(count);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		switch (workload)
+		{
+			case Workload::UNIFORM:
+				rects.push_back(ClampedRect(position(rng), position(rng), small_side(rng), small_side(rng)));
+				break;
+			case Workload::CLUSTERED:
+			{
+				const Point<float>& center = centers[rng() % centers.size()];
+				rects.push_back(ClampedRect(center.x_ + spread(rng), center.y_ + spread(rng), small_side(rng), small_side(rng)));
+				break;
+			}
+			case Workload::MIXED:
+			{
+				const bool large = unit(rng) < 0.1f;
+				const float width = large ? large_side(rng) : small_side(rng);
+				const float height = large ? large_side(rng) : small_side(rng);
+				rects.push_back(ClampedRect(position(rng), position(rng), width, height));
+				break;
+			}
+		}
+	}
+
+	return rects;
+}
+
+static Result Run(Workload workload, std::size_t count, std::size_t max_depth)
+{
+	std::mt19937 rng(static_cast<std::uint32_t>(count * 31 + max_depth * 7 + static_cast<std::size_t>(workload)));
+	const std::vector<Rect<float>> rects = Generate(workload, count, rng);
+	Result result = {};
+
+	const std::size_t bytes_before = live_bytes.load(std::memory_order_relaxed);
+	QuadTree<std::uint32_t> qt(Rect<float>(0.0f, 0.0f, world_size, world_size), max_depth);
+	std::vector<QuadTree<std::uint32_t>::ItemHandle> handles;
+	handles.reserve(count);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		handles.push_back(qt.Insert(static_cast<std::uint32_t>(i), rects[i]));
+	}
+
+	result.insert_ns_ = NsSince(start, count);
+	result.bytes_per_item_ = static_cast<double>(live_bytes.load(std::memory_order_relaxed) - bytes_before - handles.capacity() * sizeof(handles[0])) / count;
+
+	// Queries cover about 1% of the world each.
+	std::uniform_real_distribution<float> position(0.0f, world_size);
+	const float query_side = world_size * 0.1f;
+	std::vector<Rect<float>> rect_queries;
+	std::vector<Circle<float>> circle_queries;
+
+	for (std::size_t i = 0; i < search_count; ++i)
+	{
+		rect_queries.push_back(ClampedRect(position(rng), position(rng), query_side, query_side));
+		circle_queries.emplace_back(position(rng), position(rng), query_side * 0.5642f);
+	}
+
+	std::vector<QuadTree<std::uint32_t>::ItemHandle> found;
+	std::size_t found_total = 0;
+	start = std::chrono::steady_clock::now();
+
+	for (const Rect<float>& query : rect_queries)
+	{
+		found.clear();
+		qt.Search(query, &found);
+		found_total += found.size();
+	}
+
+	result.search_rect_ns_ = NsSince(start, search_count);
+	result.found_per_search_ = static_cast<double>(found_total) / search_count;
+	start = std::chrono::steady_clock::now();
+
+	for (const Circle<float>& query : circle_queries)
+	{
+		found.clear();
+		qt.Search(query, &found);
+		found_total += found.size();
+	}
+
+	result.search_circle_ns_ = NsSince(start, search_count);
+	sink = sink + found_total;
+
+	// Moving agents: every item takes a few small random steps.
+	std::vector<Rect<float>> positions = rects;
+	std::uniform_real_distribution<float> step(-4.0f, 4.0f);
+	start = std::chrono::steady_clock::now();
+
+	for (std::size_t round = 0; round < agent_steps; ++round)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			Rect<float>& rect = positions[i];
+			rect = ClampedRect(rect.top_left_.x_ + step(rng), rect.top_left_.y_ + step(rng), rect.width_, rect.height_);
+			qt.Relocate(handles[i], rect);
+		}
+	}
+
+	result.relocate_ns_ = NsSince(start, count * agent_steps);
+
+	// Churn: half of the items leave and are replaced, then everything is removed.
+	std::vector<std::size_t> order(count);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		order[i] = i;
+	}
+
+	std::shuffle(order.begin(), order.end(), rng);
+	start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < count / 2; ++i)
+	{
+		qt.Remove(handles[order[i]]);
+	}
+
+	double remove_total_ns = NsSince(start, 1);
+
+	for (std::size_t i = 0; i < count / 2; ++i)
+	{
+		handles[order[i]] = qt.Insert(static_cast<std::uint32_t>(order[i]), positions[order[i]]);
+	}
+
+	start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = count / 2; i < count; ++i)
+	{
+		qt.Remove(handles[order[i]]);
+	}
+
+	for (std::size_t i = 0; i < count / 2; ++i)
+	{
+		qt.Remove(handles[order[i]]);
+	}
+
+	remove_total_ns += NsSince(start, 1);
+	result.remove_ns_ = remove_total_ns / (count + count / 2);
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	const std::size_t max_items = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+	const std::array<Workload, 3> workloads = { Workload::UNIFORM, Workload::CLUSTERED, Workload::MIXED };
+	const std::array<std::size_t, 3> max_depths = { 4, 6, 8 };
+
+	printf("Leaf scan kernels: %s\n\n", box_scan::GetKernels().name_);
+	printf("%-10s %9s %5s %10s %10s %10s %10s %10s %8s %10s\n", "workload", "items", "depth", "insert", "remove", "relocate",
+	"rect", "circle", "found", "bytes/item");
+
+	for (Workload workload : workloads)
+	{
+		for (std::size_t count = 1000; count <= max_items; count *= 10)
+		{
+			for (std::size_t max_depth : max_depths)
+			{
+				const Result result = Run(workload, count, max_depth);
+				printf("%-10s %9zu %5zu %10.1f %10.1f %10.1f %10.1f %10.1f %8.1f %10.1f\n", WorkloadName(workload), count, max_depth,
+				result.insert_ns_, result.remove_ns_, result.relocate_ns_, result.search_rect_ns_, result.search_circle_ns_,
+				result.found_per_search_, result.bytes_per_item_);
+			}
+		}
+	}
+
+	printf("\n%s\n", "Times are ns per operation; found is the mean number of items per rect search.");
+	return 0;
+}
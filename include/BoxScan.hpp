@@ -0,0 +1,384 @@
+#ifndef BOX_SCAN_HPP
+#define BOX_SCAN_HPP
+
+#include "geometry/AABB.hpp"
+
+#include <memory_resource>
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+
+#if !defined(QUADTREE_DISABLE_SIMD) && (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define QUADTREE_BOX_SCAN_X86
+#include <immintrin.h>
+#endif
+
+// Structure-of-arrays storage for item boxes. All four columns live in one pool allocation whose
+// capacity is a multiple of 16 floats, so every column starts on a 64 byte boundary.
+class BoxSoA
+{
+private:
+    static constexpr std::size_t column_alignment = 64;
+    static constexpr std::size_t column_granularity = column_alignment / sizeof(float);
+
+    std::pmr::polymorphic_allocator<> allocator_;
+    float* data_;
+    std::uint32_t size_;
+    std::uint32_t capacity_;
+
+    void Grow(std::size_t min_capacity)
+    {
+        std::size_t new_capacity = capacity_ == 0 ? column_granularity : capacity_ * 2;
+
+        while (new_capacity < min_capacity)
+        {
+            new_capacity *= 2;
+        }
+
+        float* new_data = static_cast<float*>(allocator_.allocate_bytes(4 * new_capacity * sizeof(float), column_alignment));
+
+        for (std::size_t column = 0; column < 4 && size_ > 0; ++column)
+        {
+            std::memcpy(new_data + column * new_capacity, data_ + column * capacity_, size_ * sizeof(float));
+        }
+
+        Release();
+        data_ = new_data;
+        capacity_ = static_cast<std::uint32_t>(new_capacity);
+    }
+
+    void Release()
+    {
+        if (data_ != nullptr)
+        {
+            allocator_.deallocate_bytes(data_, 4 * capacity_ * sizeof(float), column_alignment);
+        }
+    }
+
+public:
+    explicit BoxSoA(std::pmr::memory_resource* resource) : allocator_(resource), data_(nullptr), size_(0), capacity_(0)
+    {
+    }
+
+    ~BoxSoA()
+    {
+        Release();
+    }
+
+    BoxSoA(const BoxSoA&) = delete;
+    BoxSoA& operator=(const BoxSoA&) = delete;
+
+    std::size_t Size() const
+    {
+        return size_;
+    }
+
+    std::size_t Capacity() const
+    {
+        return capacity_;
+    }
+
+    const float* MinX() const { return data_; }
+    const float* MinY() const { return data_ + capacity_; }
+    const float* MaxX() const { return data_ + 2 * capacity_; }
+    const float* MaxY() const { return data_ + 3 * capacity_; }
+
+    void Reserve(std::size_t capacity)
+    {
+        if (capacity > capacity_)
+        {
+            Grow(capacity);
+        }
+    }
+
+    AABB<float> Get(std::size_t i) const
+    {
+        return { MinX()[i], MinY()[i], MaxX()[i], MaxY()[i] };
+    }
+
+    void Set(std::size_t i, const AABB<float>& box)
+    {
+        data_[i] = box.min_x_;
+        data_[capacity_ + i] = box.min_y_;
+        data_[2 * capacity_ + i] = box.max_x_;
+        data_[3 * capacity_ + i] = box.max_y_;
+    }
+
+    void PushBack(const AABB<float>& box)
+    {
+        if (size_ == capacity_)
+        {
+            Grow(size_ + 1);
+        }
+
+        Set(size_++, box);
+    }
+
+    // Moves the last box into slot i and drops the last slot, mirroring swap-and-pop on the item slots.
+    void SwapAndPop(std::size_t i)
+    {
+        assert(i < size_);
+        Set(i, Get(size_ - 1));
+        --size_;
+    }
+};
+
+// Leaf scan kernels. Each kernel tests count boxes starting at the given column pointers and writes the
+// indices (relative to the column pointers) of boxes intersecting the query into out, which must hold
+// at least count entries. The semantics match AABB::Intersects and Circle::Intersects(AABB).
+namespace box_scan
+{
+    struct Columns
+    {
+        const float* min_x_;
+        const float* min_y_;
+        const float* max_x_;
+        const float* max_y_;
+    };
+
+    struct CircleQuery
+    {
+        float center_x_;
+        float center_y_;
+        float radius_squared_;
+    };
+
+    typedef std::size_t (*RectKernel)(const Columns& columns, std::size_t count, const AABB<float>& query, std::uint32_t* out);
+    typedef std::size_t (*CircleKernel)(const Columns& columns, std::size_t count, const CircleQuery& query, std::uint32_t* out);
+
+    inline bool IntersectsRect(const Columns& c, std::size_t i, const AABB<float>& q)
+    {
+        return q.min_x_ < c.max_x_[i] && q.max_x_ >= c.min_x_[i] && q.min_y_ < c.max_y_[i] && q.max_y_ >= c.min_y_[i];
+    }
+
+    inline bool IntersectsCircle(const Columns& c, std::size_t i, const CircleQuery& q)
+    {
+        const float dx = q.center_x_ - std::min(std::max(q.center_x_, c.min_x_[i]), c.max_x_[i]);
+        const float dy = q.center_y_ - std::min(std::max(q.center_y_, c.min_y_[i]), c.max_y_[i]);
+        return dx * dx + dy * dy <= q.radius_squared_;
+    }
+
+    // Scalar loops double as the fallback kernels (begin == 0) and as the tails of the vector kernels.
+    inline std::size_t RectTail(const Columns& c, std::size_t begin, std::size_t count, const AABB<float>& q, std::uint32_t* out, std::size_t found)
+    {
+        for (std::size_t i = begin; i < count; ++i)
+        {
+            out[found] = static_cast<std::uint32_t>(i);
+            found += IntersectsRect(c, i, q);
+        }
+
+        return found;
+    }
+
+    inline std::size_t CircleTail(const Columns& c, std::size_t begin, std::size_t count, const CircleQuery& q, std::uint32_t* out, std::size_t found)
+    {
+        for (std::size_t i = begin; i < count; ++i)
+        {
+            out[found] = static_cast<std::uint32_t>(i);
+            found += IntersectsCircle(c, i, q);
+        }
+
+        return found;
+    }
+
+    inline std::size_t EmitMask(std::uint32_t mask, std::size_t base, std::uint32_t* out, std::size_t found)
+    {
+        while (mask != 0)
+        {
+            out[found++] = static_cast<std::uint32_t>(base + std::countr_zero(mask));
+            mask &= mask - 1;
+        }
+
+        return found;
+    }
+
+    inline std::size_t ScalarRect(const Columns& c, std::size_t count, const AABB<float>& q, std::uint32_t* out)
+    {
+        return RectTail(c, 0, count, q, out, 0);
+    }
+
+    inline std::size_t ScalarCircle(const Columns& c, std::size_t count, const CircleQuery& q, std::uint32_t* out)
+    {
+        return CircleTail(c, 0, count, q, out, 0);
+    }
+
+#ifdef QUADTREE_BOX_SCAN_X86
+    __attribute__((target("sse2")))
+    inline std::size_t SseRect(const Columns& c, std::size_t count, const AABB<float>& q, std::uint32_t* out)
+    {
+        const __m128 q_min_x = _mm_set1_ps(q.min_x_);
+        const __m128 q_min_y = _mm_set1_ps(q.min_y_);
+        const __m128 q_max_x = _mm_set1_ps(q.max_x_);
+        const __m128 q_max_y = _mm_set1_ps(q.max_y_);
+        std::size_t found = 0;
+        std::size_t i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128 hit_x = _mm_and_ps(_mm_cmplt_ps(q_min_x, _mm_loadu_ps(c.max_x_ + i)), _mm_cmpge_ps(q_max_x, _mm_loadu_ps(c.min_x_ + i)));
+            const __m128 hit_y = _mm_and_ps(_mm_cmplt_ps(q_min_y, _mm_loadu_ps(c.max_y_ + i)), _mm_cmpge_ps(q_max_y, _mm_loadu_ps(c.min_y_ + i)));
+            found = EmitMask(static_cast<std::uint32_t>(_mm_movemask_ps(_mm_and_ps(hit_x, hit_y))), i, out, found);
+        }
+
+        return RectTail(c, i, count, q, out, found);
+    }
+
+    __attribute__((target("sse2")))
+    inline std::size_t SseCircle(const Columns& c, std::size_t count, const CircleQuery& q, std::uint32_t* out)
+    {
+        const __m128 center_x = _mm_set1_ps(q.center_x_);
+        const __m128 center_y = _mm_set1_ps(q.center_y_);
+        const __m128 radius_squared = _mm_set1_ps(q.radius_squared_);
+        std::size_t found = 0;
+        std::size_t i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128 dx = _mm_sub_ps(center_x, _mm_min_ps(_mm_max_ps(center_x, _mm_loadu_ps(c.min_x_ + i)), _mm_loadu_ps(c.max_x_ + i)));
+            const __m128 dy = _mm_sub_ps(center_y, _mm_min_ps(_mm_max_ps(center_y, _mm_loadu_ps(c.min_y_ + i)), _mm_loadu_ps(c.max_y_ + i)));
+            const __m128 distance_squared = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+            found = EmitMask(static_cast<std::uint32_t>(_mm_movemask_ps(_mm_cmple_ps(distance_squared, radius_squared))), i, out, found);
+        }
+
+        return CircleTail(c, i, count, q, out, found);
+    }
+
+    __attribute__((target("avx2")))
+    inline std::size_t Avx2Rect(const Columns& c, std::size_t count, const AABB<float>& q, std::uint32_t* out)
+    {
+        const __m256 q_min_x = _mm256_set1_ps(q.min_x_);
+        const __m256 q_min_y = _mm256_set1_ps(q.min_y_);
+        const __m256 q_max_x = _mm256_set1_ps(q.max_x_);
+        const __m256 q_max_y = _mm256_set1_ps(q.max_y_);
+        std::size_t found = 0;
+        std::size_t i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m256 hit_x = _mm256_and_ps(_mm256_cmp_ps(q_min_x, _mm256_loadu_ps(c.max_x_ + i), _CMP_LT_OQ), _mm256_cmp_ps(q_max_x, _mm256_loadu_ps(c.min_x_ + i), _CMP_GE_OQ));
+            const __m256 hit_y = _mm256_and_ps(_mm256_cmp_ps(q_min_y, _mm256_loadu_ps(c.max_y_ + i), _CMP_LT_OQ), _mm256_cmp_ps(q_max_y, _mm256_loadu_ps(c.min_y_ + i), _CMP_GE_OQ));
+            found = EmitMask(static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_and_ps(hit_x, hit_y))), i, out, found);
+        }
+
+        return RectTail(c, i, count, q, out, found);
+    }
+
+    __attribute__((target("avx2")))
+    inline std::size_t Avx2Circle(const Columns& c, std::size_t count, const CircleQuery& q, std::uint32_t* out)
+    {
+        const __m256 center_x = _mm256_set1_ps(q.center_x_);
+        const __m256 center_y = _mm256_set1_ps(q.center_y_);
+        const __m256 radius_squared = _mm256_set1_ps(q.radius_squared_);
+        std::size_t found = 0;
+        std::size_t i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m256 dx = _mm256_sub_ps(center_x, _mm256_min_ps(_mm256_max_ps(center_x, _mm256_loadu_ps(c.min_x_ + i)), _mm256_loadu_ps(c.max_x_ + i)));
+            const __m256 dy = _mm256_sub_ps(center_y, _mm256_min_ps(_mm256_max_ps(center_y, _mm256_loadu_ps(c.min_y_ + i)), _mm256_loadu_ps(c.max_y_ + i)));
+            const __m256 distance_squared = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            found = EmitMask(static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(distance_squared, radius_squared, _CMP_LE_OQ))), i, out, found);
+        }
+
+        return CircleTail(c, i, count, q, out, found);
+    }
+
+    __attribute__((target("avx512f")))
+    inline std::size_t Avx512Rect(const Columns& c, std::size_t count, const AABB<float>& q, std::uint32_t* out)
+    {
+        const __m512 q_min_x = _mm512_set1_ps(q.min_x_);
+        const __m512 q_min_y = _mm512_set1_ps(q.min_y_);
+        const __m512 q_max_x = _mm512_set1_ps(q.max_x_);
+        const __m512 q_max_y = _mm512_set1_ps(q.max_y_);
+        const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        std::size_t found = 0;
+        std::size_t i = 0;
+
+        for (; i + 16 <= count; i += 16)
+        {
+            __mmask16 hit = _mm512_cmp_ps_mask(q_min_x, _mm512_loadu_ps(c.max_x_ + i), _CMP_LT_OQ);
+            hit = _mm512_mask_cmp_ps_mask(hit, q_max_x, _mm512_loadu_ps(c.min_x_ + i), _CMP_GE_OQ);
+            hit = _mm512_mask_cmp_ps_mask(hit, q_min_y, _mm512_loadu_ps(c.max_y_ + i), _CMP_LT_OQ);
+            hit = _mm512_mask_cmp_ps_mask(hit, q_max_y, _mm512_loadu_ps(c.min_y_ + i), _CMP_GE_OQ);
+            _mm512_mask_compressstoreu_epi32(out + found, hit, _mm512_add_epi32(lane, _mm512_set1_epi32(static_cast<int>(i))));
+            found += static_cast<std::size_t>(std::popcount(static_cast<unsigned int>(hit)));
+        }
+
+        return RectTail(c, i, count, q, out, found);
+    }
+
+    // Same selection order as std::min(std::max(value, low), high), written with compares and blends.
+    __attribute__((target("avx512f")))
+    inline __m512 Avx512Clamp(__m512 value, __m512 low, __m512 high)
+    {
+        const __m512 raised = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(value, low, _CMP_LT_OQ), value, low);
+        return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(high, raised, _CMP_LT_OQ), raised, high);
+    }
+
+    __attribute__((target("avx512f")))
+    inline std::size_t Avx512Circle(const Columns& c, std::size_t count, const CircleQuery& q, std::uint32_t* out)
+    {
+        const __m512 center_x = _mm512_set1_ps(q.center_x_);
+        const __m512 center_y = _mm512_set1_ps(q.center_y_);
+        const __m512 radius_squared = _mm512_set1_ps(q.radius_squared_);
+        const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        std::size_t found = 0;
+        std::size_t i = 0;
+
+        for (; i + 16 <= count; i += 16)
+        {
+            const __m512 dx = _mm512_sub_ps(center_x, Avx512Clamp(center_x, _mm512_loadu_ps(c.min_x_ + i), _mm512_loadu_ps(c.max_x_ + i)));
+            const __m512 dy = _mm512_sub_ps(center_y, Avx512Clamp(center_y, _mm512_loadu_ps(c.min_y_ + i), _mm512_loadu_ps(c.max_y_ + i)));
+            const __m512 distance_squared = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+            const __mmask16 hit = _mm512_cmp_ps_mask(distance_squared, radius_squared, _CMP_LE_OQ);
+            _mm512_mask_compressstoreu_epi32(out + found, hit, _mm512_add_epi32(lane, _mm512_set1_epi32(static_cast<int>(i))));
+            found += static_cast<std::size_t>(std::popcount(static_cast<unsigned int>(hit)));
+        }
+
+        return CircleTail(c, i, count, q, out, found);
+    }
+#endif
+
+    struct Kernels
+    {
+        RectKernel rect_;
+        CircleKernel circle_;
+        // Instruction set of the kernels, reported by the benchmark.
+        const char* name_;
+    };
+
+    inline Kernels SelectKernels()
+    {
+#ifdef QUADTREE_BOX_SCAN_X86
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            return { Avx512Rect, Avx512Circle, "avx512f" };
+        }
+
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return { Avx2Rect, Avx2Circle, "avx2" };
+        }
+
+        if (__builtin_cpu_supports("sse2"))
+        {
+            return { SseRect, SseCircle, "sse2" };
+        }
+#endif
+        return { ScalarRect, ScalarCircle, "scalar" };
+    }
+
+    // Picked once per process from the features of the CPU we are running on.
+    inline const Kernels& GetKernels()
+    {
+        static const Kernels kernels = SelectKernels();
+        return kernels;
+    }
+}
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef COMMAND_QUEUE_HPP
+#define COMMAND_QUEUE_HPP
+
+#include "QuadTree.hpp"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Tree mutations posted from any number of threads and applied by the thread owning the tree, e.g.
+// once per tick. Posting is lock-free and never allocates: commands go into a fixed ring whose slots
+// carry a sequence number telling producers and the consumer whose turn it is. A post fails when the
+// ring is full, leaving the producer to retry or drop the command.
+template <typename T>
+class CommandQueue
+{
+public:
+    typedef typename QuadTree<T>::ItemHandle ItemHandle;
+    // The tag an insert was posted with and the handle of the item it created.
+    typedef std::pair<std::uint64_t, ItemHandle> InsertedItem;
+
+private:
+    enum class CommandType { INSERT, REMOVE, RELOCATE };
+
+    struct Command
+    {
+        CommandType type_;
+        ItemHandle handle_;
+        std::uint64_t tag_;
+        T item_;
+        Rect<float> area_;
+    };
+
+    struct alignas(64) Slot
+    {
+        std::atomic<std::size_t> sequence_;
+        Command command_;
+    };
+
+    struct PendingCommand
+    {
+        Command command_;
+        std::uint64_t key_;
+        std::size_t order_;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t mask_;
+    alignas(64) std::atomic<std::size_t> tail_;
+    alignas(64) std::size_t head_;
+    std::vector<PendingCommand> pending_;
+
+    bool Post(const Command& command)
+    {
+        std::size_t position = tail_.load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            Slot& slot = slots_[position & mask_];
+            const std::size_t sequence = slot.sequence_.load(std::memory_order_acquire);
+
+            if (sequence == position)
+            {
+                if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    slot.command_ = command;
+                    slot.sequence_.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (sequence < position)
+            {
+                // The consumer has not freed this slot since the last lap.
+                return false;
+            }
+            else
+            {
+                position = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Identifies the item a command targets; 0 for inserts, which target nothing yet.
+    static std::uint64_t ItemKey(const Command& command)
+    {
+        if (command.type_ == CommandType::INSERT)
+        {
+            return 0;
+        }
+
+        return ((static_cast<std::uint64_t>(command.handle_.index_) << 32) | command.handle_.generation_) + 1;
+    }
+
+public:
+    // capacity is rounded up to a power of two.
+    explicit CommandQueue(std::size_t capacity = 4096) : tail_(0), head_(0)
+    {
+        std::size_t size = 2;
+
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+
+        slots_.reset(new Slot[size]);
+        mask_ = size - 1;
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            slots_[i].sequence_.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    CommandQueue(const CommandQueue&) = delete;
+    CommandQueue& operator=(const CommandQueue&) = delete;
+
+    // Producer side, callable from any thread. Commands on handles gone stale by the time they are
+    // applied are dropped. An insert's tag is handed back by Apply with the new item's handle, so the
+    // producer can tell which of its inserts it belongs to.
+    bool Insert(const T& item, const Rect<float>& item_bbox, std::uint64_t tag = 0)
+    {
+        return Post({ CommandType::INSERT, ItemHandle(), tag, item, item_bbox });
+    }
+
+    bool Remove(const ItemHandle& handle)
+    {
+        return Post({ CommandType::REMOVE, handle, 0, T(), Rect<float>() });
+    }
+
+    bool Relocate(const ItemHandle& handle, const Rect<float>& new_area)
+    {
+        return Post({ CommandType::RELOCATE, handle, 0, T(), new_area });
+    }
+
+    // Consumer side, on the thread owning tree. Takes every command posted so far and applies them as
+    // one batch: only the last move of an item is kept, a removal drops the item's moves, and the
+    // surviving commands run in Z-order of their target position so consecutive ones touch nearby
+    // nodes. The (tag, handle) of every insert is appended to out_inserted if given. Returns the
+    // number of commands taken.
+    std::size_t Apply(QuadTree<T>* tree, std::vector<InsertedItem>* out_inserted = nullptr)
+    {
+        pending_.clear();
+
+        // Commands posted while draining wait for the next batch, so a busy producer cannot keep this going.
+        const std::size_t end = tail_.load(std::memory_order_acquire);
+
+        while (head_ != end)
+        {
+            Slot& slot = slots_[head_ & mask_];
+
+            if (slot.sequence_.load(std::memory_order_acquire) != head_ + 1)
+            {
+                break;
+            }
+
+            pending_.push_back({ slot.command_, 0, pending_.size() });
+            slot.sequence_.store(head_ + mask_ + 1, std::memory_order_release);
+            ++head_;
+        }
+
+        const std::size_t taken = pending_.size();
+
+        // Group the commands of each item, oldest first, and keep one per item.
+        std::sort(pending_.begin(), pending_.end(), [](const PendingCommand& a, const PendingCommand& b)
+            {
+                const std::uint64_t a_key = ItemKey(a.command_);
+                const std::uint64_t b_key = ItemKey(b.command_);
+                return a_key != b_key ? a_key < b_key : a.order_ < b.order_;
+            });
+
+        std::size_t kept = 0;
+
+        for (std::size_t i = 0; i < pending_.size(); ++i)
+        {
+            const std::uint64_t item_key = ItemKey(pending_[i].command_);
+
+            if (item_key != 0 && kept > 0 && ItemKey(pending_[kept - 1].command_) == item_key)
+            {
+                if (pending_[kept - 1].command_.type_ != CommandType::REMOVE)
+                {
+                    pending_[kept - 1] = pending_[i];
+                }
+
+                continue;
+            }
+
+            pending_[kept++] = pending_[i];
+        }
+
+        pending_.resize(kept);
+
+        for (PendingCommand& pending : pending_)
+        {
+            const Command& command = pending.command_;
+            const auto* qt_item = command.type_ == CommandType::REMOVE ? tree->Get(command.handle_) : nullptr;
+            pending.key_ = qt_item != nullptr ? tree->ZOrderKey(qt_item->bbox_) : tree->ZOrderKey(command.area_.GetBounds());
+        }
+
+        std::sort(pending_.begin(), pending_.end(), [](const PendingCommand& a, const PendingCommand& b)
+            {
+                return a.key_ < b.key_;
+            });
+
+        for (const PendingCommand& pending : pending_)
+        {
+            const Command& command = pending.command_;
+
+            switch (command.type_)
+            {
+                case CommandType::INSERT:
+                {
+                    const ItemHandle handle = tree->Insert(command.item_, command.area_);
+
+                    if (out_inserted != nullptr)
+                    {
+                        out_inserted->emplace_back(command.tag_, handle);
+                    }
+
+                    break;
+                }
+                case CommandType::REMOVE:
+                    tree->Remove(command.handle_);
+                    break;
+                case CommandType::RELOCATE:
+                    tree->Relocate(command.handle_, command.area_);
+                    break;
+            }
+        }
+
+        return taken;
+    }
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef CONCURRENT_QUAD_TREE_HPP
+#define CONCURRENT_QUAD_TREE_HPP
+
+#include "QuadTree.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cassert>
+#include <cstddef>
+
+// Single writer, many readers. Two copies of the tree are kept: readers query the published one
+// while the writer updates the other and logs its changes. Publish() flips the two, waits for the
+// readers still inside the old copy to leave and replays the log on it, so publishing costs as much
+// as the changes made since the last one. Readers never wait on the writer; the writer only waits for
+// queries that were already running when it published.
+//
+// Both copies see the same sequence of changes, so they hand out the same item handles and a handle
+// from Insert is valid in either.
+template <typename T>
+class ConcurrentQuadTree
+{
+public:
+    typedef QuadTree<T> TreeType;
+    typedef typename TreeType::ItemHandle ItemHandle;
+
+private:
+    enum class ChangeType { INSERT, REMOVE, RELOCATE, CLEAN_UP };
+
+    struct Change
+    {
+        ChangeType type_;
+        ItemHandle handle_;
+        T item_;
+        Rect<float> area_;
+    };
+
+    struct alignas(64) ReaderCount
+    {
+        std::atomic<std::size_t> count_;
+    };
+
+    TreeType trees_[2];
+    std::vector<Change> changes_;
+    std::atomic<std::size_t> front_;
+    mutable ReaderCount readers_[2];
+
+    std::size_t Back() const
+    {
+        return 1 - front_.load(std::memory_order_relaxed);
+    }
+
+    ItemHandle Apply(std::size_t tree_index, const Change& change)
+    {
+        TreeType& tree = trees_[tree_index];
+
+        switch (change.type_)
+        {
+            case ChangeType::INSERT:
+                return tree.Insert(change.item_, change.area_);
+            case ChangeType::REMOVE:
+                tree.Remove(change.handle_);
+                break;
+            case ChangeType::RELOCATE:
+                tree.Relocate(change.handle_, change.area_);
+                break;
+            case ChangeType::CLEAN_UP:
+                tree.CleanUp();
+                break;
+        }
+
+        return change.handle_;
+    }
+
+    // Inserts are logged with the handle they got, to check the replay hands out the same one.
+    ItemHandle Record(const Change& change)
+    {
+        changes_.push_back(change);
+        changes_.back().handle_ = Apply(Back(), change);
+        return changes_.back().handle_;
+    }
+
+public:
+    // Holds the published copy open for reading; the writer cannot recycle it while a snapshot exists.
+    // Keep snapshots short-lived, as the next Publish() waits for them.
+    class Snapshot
+    {
+    private:
+        const ConcurrentQuadTree* owner_;
+        std::size_t tree_index_;
+
+    public:
+        explicit Snapshot(const ConcurrentQuadTree* owner) : owner_(owner)
+        {
+            while (true)
+            {
+                tree_index_ = owner_->front_.load(std::memory_order_seq_cst);
+                owner_->readers_[tree_index_].count_.fetch_add(1, std::memory_order_seq_cst);
+
+                // The writer may have flipped in between; if so the count is not being watched.
+                if (owner_->front_.load(std::memory_order_seq_cst) == tree_index_)
+                {
+                    break;
+                }
+
+                owner_->readers_[tree_index_].count_.fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        ~Snapshot()
+        {
+            owner_->readers_[tree_index_].count_.fetch_sub(1, std::memory_order_release);
+        }
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        const TreeType& Tree() const
+        {
+            return owner_->trees_[tree_index_];
+        }
+
+        template <typename AreaType, typename Visitor>
+        bool Query(const AreaType& area_to_search, Visitor visitor) const
+        {
+            return Tree().Query(area_to_search, visitor);
+        }
+    };
+
+    ConcurrentQuadTree(const Rect<float>& area, const QuadTreeConfig& config) : trees_{ TreeType(area, config), TreeType(area, config) }, front_(0)
+    {
+        readers_[0].count_.store(0, std::memory_order_relaxed);
+        readers_[1].count_.store(0, std::memory_order_relaxed);
+    }
+
+    ConcurrentQuadTree(const ConcurrentQuadTree&) = delete;
+    ConcurrentQuadTree& operator=(const ConcurrentQuadTree&) = delete;
+
+    // Reader side, callable from any thread.
+    Snapshot Read() const
+    {
+        return Snapshot(this);
+    }
+
+    // Writer side, one thread only. Changes are visible to readers after the next Publish().
+    ItemHandle Insert(const T& item, const Rect<float>& item_bbox)
+    {
+        return Record({ ChangeType::INSERT, ItemHandle(), item, item_bbox });
+    }
+
+    void Remove(const ItemHandle& handle)
+    {
+        Record({ ChangeType::REMOVE, handle, T(), Rect<float>() });
+    }
+
+    void Relocate(const ItemHandle& handle, const Rect<float>& new_area)
+    {
+        Record({ ChangeType::RELOCATE, handle, T(), new_area });
+    }
+
+    void CleanUp()
+    {
+        Record({ ChangeType::CLEAN_UP, ItemHandle(), T(), Rect<float>() });
+    }
+
+    // The copy being written, for queries from the writer thread that must see unpublished changes.
+    const TreeType& WriterTree() const
+    {
+        return trees_[Back()];
+    }
+
+    void Publish()
+    {
+        const std::size_t old_front = front_.load(std::memory_order_relaxed);
+        front_.store(1 - old_front, std::memory_order_seq_cst);
+
+        // seq_cst like the reader's increment and re-check of front_: either the reader sees the flip
+        // and backs off, or this sees its count.
+        while (readers_[old_front].count_.load(std::memory_order_seq_cst) != 0)
+        {
+            std::this_thread::yield();
+        }
+
+        for (const Change& change : changes_)
+        {
+            [[maybe_unused]] const ItemHandle handle = Apply(old_front, change);
+            assert(handle == change.handle_);
+        }
+
+        changes_.clear();
+    }
+};
+
+#endif
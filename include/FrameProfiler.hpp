@@ -0,0 +1,183 @@
+#ifndef FRAME_PROFILER_HPP
+#define FRAME_PROFILER_HPP
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+
+// Scoped timers for the phases of a frame. Durations are grouped per phase name and summarized as
+// percentiles on Report(); while a trace is being captured every timed scope is also kept as a Chrome
+// trace event (load the file in chrome://tracing or Perfetto).
+class FrameProfiler
+{
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Phase
+    {
+        const char* name_;
+        std::vector<double> samples_ms_;
+    };
+
+    struct TraceEvent
+    {
+        const char* name_;
+        std::int64_t start_us_;
+        std::int64_t duration_us_;
+    };
+
+    // About 40 MB of events; the rest of a longer capture is dropped and counted.
+    static constexpr std::size_t max_trace_events = 1 << 20;
+
+    std::vector<Phase> phases_;
+    std::vector<TraceEvent> trace_events_;
+    std::string trace_path_;
+    std::size_t dropped_events_;
+    bool tracing_;
+    Clock::time_point origin_;
+
+    Phase& PhaseFor(const char* name)
+    {
+        for (Phase& phase : phases_)
+        {
+            if (phase.name_ == name)
+            {
+                return phase;
+            }
+        }
+
+        phases_.push_back({ name, {} });
+        return phases_.back();
+    }
+
+    void Record(const char* name, Clock::time_point start, Clock::time_point end)
+    {
+        PhaseFor(name).samples_ms_.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+        if (!tracing_)
+        {
+            return;
+        }
+
+        if (trace_events_.size() == max_trace_events)
+        {
+            ++dropped_events_;
+            return;
+        }
+
+        const std::int64_t start_us = std::chrono::duration_cast<std::chrono::microseconds>(start - origin_).count();
+        const std::int64_t end_us = std::chrono::duration_cast<std::chrono::microseconds>(end - origin_).count();
+        trace_events_.push_back({ name, start_us, end_us - start_us });
+    }
+
+    static double Percentile(const std::vector<double>& sorted, double fraction)
+    {
+        const std::size_t index = static_cast<std::size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[index];
+    }
+
+public:
+    // Times the enclosing scope under name, which must be a string literal (phases are told apart by
+    // address).
+    class Scope
+    {
+    private:
+        FrameProfiler* profiler_;
+        const char* name_;
+        Clock::time_point start_;
+
+    public:
+        Scope(FrameProfiler* profiler, const char* name) : profiler_(profiler), name_(name), start_(Clock::now())
+        {
+        }
+
+        ~Scope()
+        {
+            profiler_->Record(name_, start_, Clock::now());
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    FrameProfiler() : dropped_events_(0), tracing_(false), origin_(Clock::now())
+    {
+    }
+
+    ~FrameProfiler()
+    {
+        StopTrace();
+    }
+
+    FrameProfiler(const FrameProfiler&) = delete;
+    FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+    bool Tracing() const
+    {
+        return tracing_;
+    }
+
+    void StartTrace(const std::string& path)
+    {
+        trace_events_.clear();
+        trace_path_ = path;
+        dropped_events_ = 0;
+        tracing_ = true;
+    }
+
+    // Writes the events captured since StartTrace as a trace-event JSON file.
+    void StopTrace()
+    {
+        if (!tracing_)
+        {
+            return;
+        }
+
+        tracing_ = false;
+        std::FILE* file = std::fopen(trace_path_.c_str(), "w");
+
+        if (file == nullptr)
+        {
+            printf("%s%s\n", "Failed to write trace file ", trace_path_.c_str());
+            return;
+        }
+
+        std::fprintf(file, "%s", "{\"traceEvents\":[");
+
+        for (std::size_t i = 0; i < trace_events_.size(); ++i)
+        {
+            const TraceEvent& event = trace_events_[i];
+            std::fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%lld,\"dur\":%lld}", i == 0 ? "" : ",\n",
+            event.name_, static_cast<long long>(event.start_us_), static_cast<long long>(event.duration_us_));
+        }
+
+        std::fprintf(file, "%s", "]}\n");
+        std::fclose(file);
+        printf("Wrote %zu trace events to %s (%zu dropped)\n", trace_events_.size(), trace_path_.c_str(), dropped_events_);
+        trace_events_.clear();
+        trace_events_.shrink_to_fit();
+    }
+
+    // Prints count and p50/p95/p99/max milliseconds of every phase timed since the last report, then
+    // starts over. Meant to be called once per second.
+    void Report(bool print)
+    {
+        for (Phase& phase : phases_)
+        {
+            if (print && !phase.samples_ms_.empty())
+            {
+                std::sort(phase.samples_ms_.begin(), phase.samples_ms_.end());
+                printf("%-12s n %5zu  p50 %7.3f  p95 %7.3f  p99 %7.3f  max %7.3f ms\n", phase.name_, phase.samples_ms_.size(),
+                Percentile(phase.samples_ms_, 0.5), Percentile(phase.samples_ms_, 0.95), Percentile(phase.samples_ms_, 0.99), phase.samples_ms_.back());
+            }
+
+            phase.samples_ms_.clear();
+        }
+    }
+};
+
+#endif
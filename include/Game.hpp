@@ -2,11 +2,13 @@
 #define GAME_HPP
 
 #include "QuadTree.hpp"
+#include "FrameProfiler.hpp"
 
 #include <SDL2/SDL.h>
 
 #include <memory>
 #include <list>
+#include <vector>
 
 template <typename T>
 class Shape;
@@ -30,7 +32,7 @@ private:
 	bool debug_areas_;
 	std::unique_ptr<QuadTree<QtItemType>> qt_;
 	std::unique_ptr<Shape<float>> shape_area_;
-	std::list<QuadTree<QtItemType>::QuadTreeItemListIt> found_items_;
+	std::vector<QuadTree<QtItemType>::ItemHandle> found_items_;
 
 	float circle_r_;
 	float rect_side_;
@@ -41,6 +43,9 @@ private:
 	std::list<std::list<QtItemType>::iterator> found_;
 	std::unique_ptr<CircleTexture> circle_texture_;
 
+	FrameProfiler profiler_;
+	bool print_frame_stats_;
+
 	SDL_Window* window_;
 	SDL_Renderer* renderer_;
 
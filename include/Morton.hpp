@@ -0,0 +1,88 @@
+#ifndef MORTON_HPP
+#define MORTON_HPP
+
+#include <vector>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Z-order (Morton) helpers. The tree's codes are built from its own quadrant numbering
+// (bit 0 = east, bit 1 = south per level), so sorting by code visits cells in depth-first order.
+namespace morton
+{
+    struct Entry
+    {
+        std::uint64_t key_;
+        std::uint32_t index_;
+    };
+
+    // Appends one level to a code: quadrant is 0..3 in the tree's child order.
+    inline std::uint64_t Push(std::uint64_t code, std::size_t quadrant)
+    {
+        return (code << 2) | static_cast<std::uint64_t>(quadrant);
+    }
+
+    // Quadrant taken at level (1-based) of a code describing a cell at the given depth.
+    inline std::size_t QuadrantAt(std::uint64_t code, std::size_t depth, std::size_t level)
+    {
+        return static_cast<std::size_t>((code >> (2 * (depth - level))) & 3);
+    }
+
+    // Spreads the low 32 bits of v to the even bit positions.
+    inline std::uint64_t SpreadBits(std::uint64_t v)
+    {
+        v &= 0xffffffff;
+        v = (v | (v << 16)) & 0x0000ffff0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0f;
+        v = (v | (v << 2)) & 0x3333333333333333;
+        v = (v | (v << 1)) & 0x5555555555555555;
+        return v;
+    }
+
+    // Code of a cell on a 2^32 x 2^32 grid, in the same order as the tree's quadrant paths.
+    inline std::uint64_t Encode(std::uint32_t x, std::uint32_t y)
+    {
+        return SpreadBits(x) | (SpreadBits(y) << 1);
+    }
+
+    // LSD radix sort on the key, 8 bits per pass. Passes where every key has the same digit are
+    // skipped, so short codes only pay for the bytes they use. Stable, so equal keys keep input order.
+    inline void SortByKey(std::vector<Entry>& entries)
+    {
+        std::vector<Entry> buffer(entries.size());
+
+        for (std::size_t shift = 0; shift < 64; shift += 8)
+        {
+            std::array<std::size_t, 256> offsets = {};
+
+            for (const Entry& entry : entries)
+            {
+                ++offsets[(entry.key_ >> shift) & 0xff];
+            }
+
+            if (!entries.empty() && offsets[(entries.front().key_ >> shift) & 0xff] == entries.size())
+            {
+                continue;
+            }
+
+            std::size_t sum = 0;
+
+            for (std::size_t& offset : offsets)
+            {
+                const std::size_t count = offset;
+                offset = sum;
+                sum += count;
+            }
+
+            for (const Entry& entry : entries)
+            {
+                buffer[offsets[(entry.key_ >> shift) & 0xff]++] = entry;
+            }
+
+            entries.swap(buffer);
+        }
+    }
+}
+
+#endif
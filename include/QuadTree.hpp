@@ -3,19 +3,38 @@
 
 #include "geometry/Point.hpp"
 #include "geometry/Shape.hpp"
+#include "geometry/AABB.hpp"
 #include "geometry/Rect.hpp"
 #include "geometry/Circle.hpp"
+#include "BoxScan.hpp"
+#include "Morton.hpp"
+#include "ThreadPool.hpp"
+#include "QuadTreeStats.hpp"
+#include "QuadTreeSnapshot.hpp"
 
 #include <list>
+#include <memory_resource>
 #include <iostream>
 #include <iomanip>
 #include <memory>
 #include <array>
 #include <vector>
+#include <unordered_map>
 #include <cassert>
 #include <type_traits>
 #include <algorithm>
+#include <functional>
+#include <optional>
+#include <limits>
 #include <cmath>
+#include <span>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ranges>
+#include <iterator>
+#include <cstdint>
 
 // template <typename T>
 // struct extract_value_type
@@ -44,6 +63,25 @@
 // template <typename T>
 // using innermost = typename innermost_impl<T>::type;
 
+struct QuadTreeConfig
+{
+    std::size_t max_depth_ = 6;
+    // Items a node keeps before it splits and pushes them down. 0 keeps the original behaviour
+    // where every item sinks to the deepest node that fully contains it.
+    std::size_t node_capacity_ = 0;
+    // A split subtree holding at most this many items is collapsed back into its root. Keep it
+    // below node_capacity_ so nodes do not flip between split and merged on every insert/remove.
+    std::size_t merge_threshold_ = 0;
+    // Loose quadtree factor k >= 1: a node accepts items inside its area grown to k times its size,
+    // and items are routed by their center. 1 gives the classic tight tree; around 2 lets items
+    // sink to a depth matching their size instead of piling up on midlines.
+    float looseness_ = 1.0f;
+    // Nodes left empty by Remove/Relocate are normally freed right away by walking up from them. When
+    // set, they are only queued and freed by Compact(), so entities moving back and forth across a
+    // cell do not free and reallocate its node every tick.
+    bool deferred_cleanup_ = false;
+};
+
 template <typename T>
 class QuadTree
 {
@@ -51,315 +89,2084 @@ private:
     class Node;
 
 public:
-    struct QuadTreeItem;
-
     // typedef innermost<T> NumType;
     // static_assert(std::is_arithmetic_v<NumType>);
-    
-    typedef typename std::list<QuadTreeItem>::iterator QuadTreeItemListIt;
+
+    // Stable reference to an item. Its index is reused once the item is removed, but with a bumped
+    // generation, so a handle outliving its item is detected instead of reaching whatever took its place.
+    struct ItemHandle
+    {
+        std::uint32_t index_ = std::numeric_limits<std::uint32_t>::max();
+        std::uint32_t generation_ = 0;
+
+        bool operator==(const ItemHandle& other) const = default;
+    };
 
     struct QuadTreeItem
     {
         T item_;
-        Rect<float> bbox_;
+        AABB<float> bbox_;
         Node* node_;
-        typename std::list<QuadTreeItemListIt>::iterator node_list_it_;
+        std::size_t node_slot_;
+        ItemHandle handle_;
     };
 
-private:
-    class Node
+    struct Neighbor
     {
-    public:
-        Node* parent_;
-        std::size_t depth_;
-        Rect<float> area_;
-        std::array<Rect<float>, 4> children_areas_;
-        std::array<std::unique_ptr<Node>, 4> children_;
-        std::list<QuadTreeItemListIt> qt_items_its_;
+        ItemHandle handle_;
+        float distance_;
+    };
+
+    // Hit of origin + t * direction with an item's bbox, t being the entry parameter.
+    struct RayHit
+    {
+        ItemHandle handle_;
+        float t_;
+    };
+
+    // Output of SearchBatch in compressed-row form: the matches of query q are
+    // items_[offsets_[q], offsets_[q + 1]). Keep one around between batches so its buffers, including the
+    // per-worker scratch, are reused instead of reallocated.
+    struct BatchResult
+    {
+        std::vector<std::size_t> offsets_;
+        std::vector<ItemHandle> items_;
+
+        std::vector<std::vector<ItemHandle>> worker_items_;
+        std::vector<std::size_t> local_offsets_;
+        std::vector<std::uint32_t> workers_;
 
-        Node(Node* parent, std::size_t depth, const Rect<float>& area) : parent_(parent), depth_(depth), area_(area)
+        std::size_t Size() const
         {
-            children_ = { nullptr, nullptr, nullptr, nullptr };
+            return offsets_.empty() ? 0 : offsets_.size() - 1;
         }
 
-        void CalculateChildrenAreas()
+        std::span<const ItemHandle> Matches(std::size_t query_index) const
         {
-            const float ax = area_.top_left_.x_;
-            const float ay = area_.top_left_.y_;
-
-            const float half_w = static_cast<float>(area_.width_ / 2.0f);
-            const float half_h = static_cast<float>(area_.height_ / 2.0f);
-            
-            children_areas_[0] = Rect<float>(ax, ay, half_w, half_h);
-            children_areas_[1] = Rect<float>(ax + half_w, ay, half_w, half_h);
-            children_areas_[2] = Rect<float>(ax, ay + half_h, half_w, half_h);
-            children_areas_[3] = Rect<float>(ax + half_w, ay + half_h, half_w, half_h);
+            return std::span<const ItemHandle>(items_.data() + offsets_[query_index], offsets_[query_index + 1] - offsets_[query_index]);
         }
+    };
 
-        void Insert(const QuadTreeItemListIt& qt_item_it, std::size_t max_depth)
+    // Items intersecting an area, found as the range is iterated rather than up front, so taking the
+    // first few matches only walks the part of the tree leading to them. The walk keeps one frame per
+    // level of the current path. The tree must not be modified while an iterator is in use.
+    template <typename AreaType>
+    class QueryRange : public std::ranges::view_interface<QueryRange<AreaType>>
+    {
+    private:
+        struct Frame
         {
-            for (std::size_t i = 0; i < 4; ++i)
-            {
-                if (children_areas_[i].Contains(qt_item_it->bbox_))
-                {
-                    if (depth_ + 1 <= max_depth)
-                    {
-                        if (children_[i] == nullptr)
-                        {
-                            const float ax = area_.top_left_.x_;
-                            const float ay = area_.top_left_.y_;
-
-                            const float half_w = static_cast<float>(area_.width_ / 2.0f);
-                            const float half_h = static_cast<float>(area_.height_ / 2.0f);
-
-                            Rect<float> node_area;
-                            
-                            switch (i)
-                            {
-                                case 0:
-                                    node_area = Rect<float>(ax, ay, half_w, half_h);
-                                    break;
-                                case 1:
-                                    node_area = Rect<float>(ax + half_w, ay, half_w, half_h);
-                                    break;
-                                case 2:
-                                    node_area = Rect<float>(ax, ay + half_h, half_w, half_h);
-                                    break;
-                                case 3:
-                                    node_area = Rect<float>(ax + half_w, ay + half_h, half_w, half_h);
-                                    break;
-                                default:
-                                    assert(false);
-                            }
-
-                            children_[i] = std::make_unique<Node>(this, depth_ + 1, node_area);
-                            children_[i]->CalculateChildrenAreas();
-                        }
+            const Node* node_;
+            // Set when the area contains the node's bounds, so its items need no test.
+            bool covered_;
+            std::size_t slot_;
+            std::size_t child_;
+        };
 
-                        return children_[i]->Insert(qt_item_it, max_depth);
-                    }
-                }
-            }
-            
-            qt_item_it->node_ = this;
-            qt_items_its_.push_back({ qt_item_it });
-            qt_item_it->node_list_it_ = std::prev(std::end(qt_items_its_));
-        }
+        const Node* root_;
+        std::size_t max_depth_;
+        AreaType area_;
 
-        void AddItems(std::list<QuadTreeItemListIt>* out_items_list)
+    public:
+        class Iterator
         {
-            if (out_items_list == nullptr)
+        private:
+            AreaType area_;
+            std::vector<Frame> stack_;
+            const QuadTreeItem* current_;
+
+            void Push(const Node* node, bool covered)
             {
-                return;
+                QUADTREE_COUNT(nodes_visited_, 1);
+                stack_.push_back({ node, covered, 0, 0 });
             }
 
-            out_items_list->insert(std::end(*out_items_list), std::begin(qt_items_its_), std::end(qt_items_its_));
+            void Advance()
+            {
+                current_ = nullptr;
 
-            std::for_each(children_.begin(), children_.end(), [out_items_list](const std::unique_ptr<Node>& child_ptr)
+                while (!stack_.empty())
                 {
-                    if (child_ptr != nullptr)
+                    Frame& frame = stack_.back();
+
+                    while (frame.slot_ < frame.node_->boxes_.Size())
                     {
-                        child_ptr->AddItems(out_items_list);
+                        const std::size_t slot = frame.slot_++;
+                        QUADTREE_COUNT(items_tested_, frame.covered_ ? 0 : 1);
+
+                        if (frame.covered_ || area_.Intersects(frame.node_->boxes_.Get(slot)))
+                        {
+                            QUADTREE_COUNT(items_returned_, 1);
+                            current_ = &frame.node_->ItemAt(slot);
+                            return;
+                        }
                     }
-                });
-        }
 
-        void Search(const std::unique_ptr<Shape<float>>& area_to_search, std::list<QuadTreeItemListIt>* out_items_list)
-        {
-            if (area_to_search == nullptr || out_items_list == nullptr)
-            {
-                return;
-            }
-            
-            std::for_each(qt_items_its_.begin(), qt_items_its_.end(), [&area_to_search, out_items_list](const QuadTreeItemListIt& qt_item_it)
-                {
-                    if (area_to_search->Intersects(qt_item_it->bbox_))
+                    if (frame.child_ == 4)
                     {
-                        out_items_list->push_back(qt_item_it);
+                        stack_.pop_back();
+                        continue;
                     }
-                });
 
-            for (std::size_t i = 0; i < 4; ++i)
-            {
-                if (children_[i] != nullptr)
-                {
-                    if (area_to_search->Contains(children_areas_[i]))
+                    const Node* child_ptr = frame.node_->children_[frame.child_++];
+
+                    if (child_ptr == nullptr)
                     {
-                        children_[i]->AddItems(out_items_list);
+                        continue;
                     }
-                    else if (area_to_search->Intersects(children_areas_[i]))
+
+                    if (frame.covered_ || area_.Contains(child_ptr->bounds_))
+                    {
+                        QUADTREE_COUNT(subtree_adds_, frame.covered_ ? 0 : 1);
+                        Push(child_ptr, true);
+                    }
+                    else if (area_.Intersects(child_ptr->bounds_))
                     {
-                        children_[i]->Search(area_to_search, out_items_list);
+                        Push(child_ptr, false);
                     }
                 }
             }
-        }
 
-        void GetAreas(std::vector<Rect<float>>* out_areas)
-        {
-            const bool all_children_empty = std::all_of(children_.begin(), children_.end(), [](const std::unique_ptr<Node>& child_ptr)
-                {
-                    return child_ptr == nullptr;
-                });
+        public:
+            typedef std::input_iterator_tag iterator_concept;
+            typedef QuadTreeItem value_type;
+            typedef std::ptrdiff_t difference_type;
 
-            if (all_children_empty)
+            Iterator() : current_(nullptr)
             {
-                return;
             }
 
-            std::for_each(children_areas_.begin(), children_areas_.end(), [out_areas](const Rect<float>& child_area)
+            Iterator(const Node* root, std::size_t max_depth, const AreaType& area) : area_(area), current_(nullptr)
             {
-                out_areas->push_back(child_area);
-            });
-
-            std::for_each(children_.begin(), children_.end(), [out_areas](const std::unique_ptr<Node>& child_ptr)
-                {
-                    if (child_ptr != nullptr)
-                    {
-                        child_ptr->GetAreas(out_areas);
-                    }
-                });
-        }
+                stack_.reserve(max_depth + 1);
+                Push(root, false);
+                Advance();
+            }
 
-        bool CleanUp()
-        {
-            const bool northwest = children_[0] == nullptr || children_[0]->CleanUp();
-            const bool northeast = children_[1] == nullptr || children_[1]->CleanUp();
-            const bool southwest = children_[2] == nullptr || children_[2]->CleanUp();
-            const bool southeast = children_[3] == nullptr || children_[3]->CleanUp();
+            const QuadTreeItem& operator*() const
+            {
+                return *current_;
+            }
 
-            if (northwest)
+            const QuadTreeItem* operator->() const
             {
-                children_[0].reset(nullptr);
+                return current_;
             }
 
-            if (northeast)
+            Iterator& operator++()
             {
-                children_[1].reset(nullptr);
+                Advance();
+                return *this;
             }
 
-            if (southwest)
+            void operator++(int)
             {
-                children_[2].reset(nullptr);
+                Advance();
             }
 
-            if (southeast)
+            bool operator==(std::default_sentinel_t) const
             {
-                children_[3].reset(nullptr);
+                return current_ == nullptr;
             }
+        };
+
+        QueryRange() : root_(nullptr), max_depth_(0)
+        {
+        }
+
+        QueryRange(const Node* root, std::size_t max_depth, const AreaType& area) : root_(root), max_depth_(max_depth), area_(area)
+        {
+        }
+
+        Iterator begin() const
+        {
+            return Iterator(root_, max_depth_, area_);
+        }
 
-            return northwest && northeast && southwest && southeast && qt_items_its_.empty();
+        std::default_sentinel_t end() const
+        {
+            return std::default_sentinel;
         }
     };
 
-    std::size_t max_depth_;
-    std::unique_ptr<Node> root_;
-    std::list<QuadTreeItem> items_;
+private:
+    typedef std::pmr::polymorphic_allocator<Node> NodeAllocator;
 
-public:
-    QuadTree(const Rect<float>& area, const std::size_t max_depth) : max_depth_(max_depth)
+    // Visitors may return bool (false stops the traversal) or nothing (visit everything).
+    template <typename Visitor>
+    static bool Visit(Visitor& visitor, const QuadTreeItem& qt_item)
     {
-        root_ = std::make_unique<Node>(nullptr, 0, area);
-        root_->CalculateChildrenAreas();
-    }
+        QUADTREE_COUNT(items_returned_, 1);
 
-    void Resize(const Rect<float>& area)
-    {
-        Reset();
-        root_->area_ = area;
-        root_->CalculateChildrenAreas();
+        if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, const QuadTreeItem&>>)
+        {
+            visitor(qt_item);
+            return true;
+        }
+        else
+        {
+            return static_cast<bool>(visitor(qt_item));
+        }
     }
 
-    void Reset()
+    // Position of a handle's item in items_ while it is alive; otherwise the next free handle index.
+    struct HandleSlot
     {
-        root_->qt_items_its_.clear();
-        const Rect<float> root_area = root_->area_;
-        root_.reset(nullptr);
-        items_.clear();
+        std::uint32_t dense_index_;
+        std::uint32_t generation_;
+    };
 
-        root_ = std::make_unique<Node>(nullptr, 0, root_area);
-        root_->CalculateChildrenAreas();
-    }
+    static constexpr std::uint32_t no_index = std::numeric_limits<std::uint32_t>::max();
+
+    // An item together with its box, as carried down the tree by the overlapping pair walk.
+    typedef std::pair<AABB<float>, const QuadTreeItem*> BoxedItem;
 
-    std::size_t Size()
+    // Work handed to a pool thread by the parallel pair walk: either all pairs within node_'s subtree,
+    // given the ancestor items that reach into it, or, when other_ is set, all pairs between the
+    // subtrees of node_ and other_.
+    struct PairTask
     {
-        return items_.size();
-    }
+        const Node* node_;
+        const Node* other_;
+        std::vector<BoxedItem> ancestors_;
+    };
+
+    // Leaf boxes are tested in chunks of this many against the SIMD kernels picked at startup.
+    static constexpr std::size_t scan_chunk = 256;
 
-    bool Empty()
+    static AABB<float> Loosen(const AABB<float>& area, float looseness)
     {
-        return items_.empty();
+        const float grow = (looseness - 1.0f) / 2.0f;
+        return area.Inflate(area.GetWidth() * grow, area.GetHeight() * grow);
     }
 
-    void Insert(const T& item, const Rect<float>& item_bbox)
+    static AABB<float> ChildAreaOf(const AABB<float>& area, std::size_t i)
     {
-        if (item_bbox.top_left_.x_ < 0 || item_bbox.top_left_.x_ > (root_->area_.top_left_.x_ + root_->area_.width_) || 
-        item_bbox.top_left_.y_ < 0 || item_bbox.top_left_.y_ > (root_->area_.top_left_.y_ + root_->area_.height_))
+        const float mid_x = area.min_x_ + (area.GetWidth() / 2.0f);
+        const float mid_y = area.min_y_ + (area.GetHeight() / 2.0f);
+
+        switch (i)
         {
-            printf("%s%f%s%f%s\n", "Failed to insert! Position: x { ", item_bbox.top_left_.x_, " } y { ", item_bbox.top_left_.y_, " } is out of bounds!");
+            case 0:
+                return { area.min_x_, area.min_y_, mid_x, mid_y };
+            case 1:
+                return { mid_x, area.min_y_, area.max_x_, mid_y };
+            case 2:
+                return { area.min_x_, mid_y, mid_x, area.max_y_ };
+            case 3:
+                return { mid_x, mid_y, area.max_x_, area.max_y_ };
+            default:
+                assert(false);
+                return area;
         }
+    }
+
+    // Index of the child quadrant of area whose bounds fully contain bbox, or 4 if it has to stay in
+    // area's node. The quadrant is picked by the box center; in a tight tree only that quadrant could
+    // contain it anyway.
+    static std::size_t ChildIndexOf(const AABB<float>& area, const AABB<float>& bbox, float looseness)
+    {
+        const float mid_x = area.min_x_ + (area.GetWidth() / 2.0f);
+        const float mid_y = area.min_y_ + (area.GetHeight() / 2.0f);
+        const float center_x = bbox.min_x_ + (bbox.GetWidth() / 2.0f);
+        const float center_y = bbox.min_y_ + (bbox.GetHeight() / 2.0f);
+        const std::size_t i = (center_x >= mid_x ? 1 : 0) + (center_y >= mid_y ? 2 : 0);
 
-        QuadTreeItem qt_item;
-        qt_item.item_ = item;
-        qt_item.bbox_ = item_bbox;
-        items_.push_back(qt_item);
-        root_->Insert(std::prev(std::end(items_)), max_depth_);
+        return Loosen(ChildAreaOf(area, i), looseness).Contains(bbox) ? i : 4;
     }
 
-    void Remove(const QuadTreeItemListIt& qt_item_it)
+    static std::size_t ScanBoxes(const Rect<float>& area, const box_scan::Columns& columns, std::size_t count, std::uint32_t* out)
     {
-        qt_item_it->node_->qt_items_its_.erase(qt_item_it->node_list_it_);
-        items_.erase(qt_item_it);
+        return box_scan::GetKernels().rect_(columns, count, area.GetBounds(), out);
     }
 
-    void Relocate(const QuadTreeItemListIt& qt_item_it, const Rect<float>& new_area)
+    static std::size_t ScanBoxes(const Circle<float>& area, const box_scan::Columns& columns, std::size_t count, std::uint32_t* out)
+    {
+        return box_scan::GetKernels().circle_(columns, count, { area.center_.x_, area.center_.y_, area.radius_ * area.radius_ }, out);
+    }
+
+    class Node
     {
-        const Rect<float>& old_area = qt_item_it->bbox_;
-        const std::array<Rect<float>, 4>& children_areas = qt_item_it->node_->children_areas_;
-        const bool area_contains = qt_item_it->node_->area_.Contains(old_area) == qt_item_it->node_->area_.Contains(new_area);
-        const bool nw_contains = children_areas[0].Contains(old_area) == children_areas[0].Contains(new_area);
-        const bool ne_contains = children_areas[1].Contains(old_area) == children_areas[1].Contains(new_area);
-        const bool sw_contains = children_areas[2].Contains(old_area) == children_areas[2].Contains(new_area);
-        const bool se_contains = children_areas[3].Contains(old_area) == children_areas[3].Contains(new_area);
+    public:
+        Node* parent_;
+        std::size_t depth_;
+        std::size_t count_;
+        bool split_;
+        // Set on the nodes a bulk load placed items under, so FinishBulk only revisits those.
+        bool bulk_touched_;
+        // Set while the node's cell waits in pending_prunes_, so it is queued once however often it empties.
+        bool prune_queued_;
+        AABB<float> area_;
+        AABB<float> bounds_;
+        std::array<Node*, 4> children_;
+        // Positions of the node's items in the tree's dense item array.
+        std::vector<QuadTreeItem>* tree_items_;
+        std::pmr::vector<std::uint32_t> item_indices_;
+        BoxSoA boxes_;
 
-        if (area_contains && (qt_item_it->node_->depth_ + 1 > max_depth_ || (nw_contains && ne_contains && sw_contains && se_contains)))
+        Node(Node* parent, std::size_t depth, const AABB<float>& area, float looseness, std::vector<QuadTreeItem>* tree_items, std::pmr::memory_resource* resource) : 
+        parent_(parent), 
+        depth_(depth), 
+        count_(0), 
+        split_(false), 
+        bulk_touched_(false), 
+        prune_queued_(false), 
+        area_(area), 
+        bounds_(Loosen(area, looseness)), 
+        tree_items_(tree_items), 
+        item_indices_(resource), 
+        boxes_(resource)
         {
-            return;
+            children_ = { nullptr, nullptr, nullptr, nullptr };
         }
 
-        qt_item_it->node_->qt_items_its_.erase(qt_item_it->node_list_it_);
-        
-        if (qt_item_it->node_->qt_items_its_.empty())
+        ~Node()
         {
-            CleanUp();
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                DestroyChild(i);
+            }
         }
-        
-        qt_item_it->bbox_ = new_area;
-        root_->Insert(qt_item_it, max_depth_);
-    }
 
-    void CleanUp()
-    {
-        root_->CleanUp();
-    }
+        Node(const Node&) = delete;
+        Node& operator=(const Node&) = delete;
 
-    std::list<QuadTreeItemListIt> Search(const std::unique_ptr<Shape<float>>& area_to_search) const
-    {
-        std::list<QuadTreeItemListIt> items_list;
-        root_->Search(area_to_search, &items_list);
-        return items_list;
-    }
+        void DestroyChild(std::size_t i)
+        {
+            if (children_[i] != nullptr)
+            {
+                // Subtrees built by a parallel bulk load live in their own resource, so ask the child.
+                NodeAllocator(children_[i]->item_indices_.get_allocator().resource()).delete_object(children_[i]);
+                children_[i] = nullptr;
+            }
+        }
 
-    std::vector<Rect<float>> GetAreas()
-    {
-        std::vector<Rect<float>> areas;
-        root_->GetAreas(&areas);
-        return areas;
-    }
+        QuadTreeItem& ItemAt(std::size_t slot) const
+        {
+            return (*tree_items_)[item_indices_[slot]];
+        }
 
-    std::list<QuadTreeItem>& GetItems()
-    {
-        return items_;
+        void AddItem(std::uint32_t item_index)
+        {
+            QuadTreeItem& qt_item = (*tree_items_)[item_index];
+            qt_item.node_ = this;
+            qt_item.node_slot_ = item_indices_.size();
+            item_indices_.push_back(item_index);
+            boxes_.PushBack(qt_item.bbox_);
+        }
+
+        void ReserveItems(std::size_t count)
+        {
+            item_indices_.reserve(count);
+            boxes_.Reserve(count);
+        }
+
+        void RemoveItem(std::uint32_t item_index)
+        {
+            // Swap-and-pop keeps the slots contiguous; the item moved into the hole gets its slot patched.
+            const std::size_t slot = (*tree_items_)[item_index].node_slot_;
+            item_indices_[slot] = item_indices_.back();
+            ItemAt(slot).node_slot_ = slot;
+            item_indices_.pop_back();
+            boxes_.SwapAndPop(slot);
+        }
+
+        std::size_t IndexInParent() const
+        {
+            return static_cast<std::size_t>(std::find(parent_->children_.begin(), parent_->children_.end(), this) - parent_->children_.begin());
+        }
+
+        // Children areas are derived from the node's own box on demand instead of being stored per node.
+        AABB<float> ChildArea(std::size_t i) const
+        {
+            return ChildAreaOf(area_, i);
+        }
+
+        std::size_t ChildIndexFor(const AABB<float>& bbox, float looseness) const
+        {
+            return ChildIndexOf(area_, bbox, looseness);
+        }
+
+        Node* GetOrCreateChild(std::size_t i, float looseness)
+        {
+            return GetOrCreateChild(i, looseness, item_indices_.get_allocator().resource());
+        }
+
+        // A child created here allocates itself and its own subtree from resource.
+        Node* GetOrCreateChild(std::size_t i, float looseness, std::pmr::memory_resource* resource)
+        {
+            if (children_[i] == nullptr)
+            {
+                children_[i] = NodeAllocator(resource).template new_object<Node>(this, depth_ + 1, ChildArea(i), looseness, tree_items_, resource);
+            }
+
+            return children_[i];
+        }
+
+        void Insert(std::uint32_t item_index, const QuadTreeConfig& config)
+        {
+            ++count_;
+
+            if (!split_)
+            {
+                if (item_indices_.size() < config.node_capacity_ || depth_ >= config.max_depth_)
+                {
+                    AddItem(item_index);
+                    return;
+                }
+
+                Split(config);
+            }
+
+            const std::size_t child_index = ChildIndexFor((*tree_items_)[item_index].bbox_, config.looseness_);
+
+            if (child_index < 4)
+            {
+                GetOrCreateChild(child_index, config.looseness_)->Insert(item_index, config);
+            }
+            else
+            {
+                AddItem(item_index);
+            }
+        }
+
+        // Pushes every item that fits in a single quadrant down a level. Items straddling a midline stay.
+        void Split(const QuadTreeConfig& config)
+        {
+            split_ = true;
+
+            for (std::size_t slot = 0; slot < item_indices_.size();)
+            {
+                const std::uint32_t item_index = item_indices_[slot];
+                const std::size_t child_index = ChildIndexFor(boxes_.Get(slot), config.looseness_);
+
+                if (child_index < 4)
+                {
+                    // Swap-and-pop refills this slot, so it is examined again.
+                    RemoveItem(item_index);
+                    GetOrCreateChild(child_index, config.looseness_)->Insert(item_index, config);
+                }
+                else
+                {
+                    ++slot;
+                }
+            }
+        }
+
+        // Pulls every item of the subtree into this node and drops the children.
+        void Collapse()
+        {
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                if (children_[i] != nullptr)
+                {
+                    children_[i]->MoveItemsTo(this);
+                    DestroyChild(i);
+                }
+            }
+
+            split_ = false;
+        }
+
+        void MoveItemsTo(Node* target)
+        {
+            for (const std::uint32_t item_index : item_indices_)
+            {
+                target->AddItem(item_index);
+            }
+
+            std::for_each(children_.begin(), children_.end(), [target](Node* child_ptr)
+                {
+                    if (child_ptr != nullptr)
+                    {
+                        child_ptr->MoveItemsTo(target);
+                    }
+                });
+        }
+
+        // Restores counts and split state after items were placed directly by a bulk load: subtrees
+        // within capacity become a single leaf, larger ones are split like an incremental insert would.
+        // Children the load did not touch, or that were already finished on their own, keep their
+        // state and only contribute their count.
+        void FinishBulk(const QuadTreeConfig& config)
+        {
+            bulk_touched_ = false;
+            count_ = item_indices_.size();
+
+            for (Node* child_ptr : children_)
+            {
+                if (child_ptr != nullptr)
+                {
+                    if (child_ptr->bulk_touched_)
+                    {
+                        child_ptr->FinishBulk(config);
+                    }
+
+                    count_ += child_ptr->count_;
+                }
+            }
+
+            if (config.node_capacity_ > 0 && count_ <= config.node_capacity_)
+            {
+                Collapse();
+            }
+            else if (!split_ && count_ > 0 && depth_ < config.max_depth_)
+            {
+                Split(config);
+            }
+        }
+
+        template <typename Visitor>
+        bool AddItems(Visitor& visitor)
+        {
+            QUADTREE_COUNT(nodes_visited_, 1);
+
+            for (std::size_t slot = 0; slot < item_indices_.size(); ++slot)
+            {
+                if (!Visit(visitor, ItemAt(slot)))
+                {
+                    return false;
+                }
+            }
+
+            return std::all_of(children_.begin(), children_.end(), [&visitor](Node* child_ptr)
+                {
+                    return child_ptr == nullptr || child_ptr->AddItems(visitor);
+                });
+        }
+
+        // Calls on_hit(slot) for every item of this node whose box intersects the area, stopping when it
+        // returns false. Rects and circles go through the SIMD kernels a chunk at a time.
+        template <typename AreaType, typename OnHit>
+        bool ScanItems(const AreaType& area_to_search, OnHit&& on_hit) const
+        {
+            if constexpr (std::is_same_v<AreaType, Rect<float>> || std::is_same_v<AreaType, Circle<float>>)
+            {
+                const std::size_t size = boxes_.Size();
+                std::uint32_t hits[scan_chunk];
+
+                for (std::size_t begin = 0; begin < size; begin += scan_chunk)
+                {
+                    const box_scan::Columns columns = { boxes_.MinX() + begin, boxes_.MinY() + begin, boxes_.MaxX() + begin, boxes_.MaxY() + begin };
+                    const std::size_t found = ScanBoxes(area_to_search, columns, std::min(scan_chunk, size - begin), hits);
+                    QUADTREE_COUNT(items_tested_, std::min(scan_chunk, size - begin));
+
+                    for (std::size_t i = 0; i < found; ++i)
+                    {
+                        if (!on_hit(begin + hits[i]))
+                        {
+                            return false;
+                        }
+                    }
+                }
+            }
+            else
+            {
+                for (std::size_t i = 0; i < boxes_.Size(); ++i)
+                {
+                    QUADTREE_COUNT(items_tested_, 1);
+
+                    if (area_to_search.Intersects(boxes_.Get(i)) && !on_hit(i))
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            return true;
+        }
+
+        template <typename AreaType, typename Visitor>
+        bool SearchItems(const AreaType& area_to_search, Visitor& visitor)
+        {
+            return ScanItems(area_to_search, [this, &visitor](std::size_t slot)
+                {
+                    return Visit(visitor, ItemAt(slot));
+                });
+        }
+
+        template <typename AreaType, typename Visitor>
+        bool Search(const AreaType& area_to_search, Visitor& visitor)
+        {
+            QUADTREE_COUNT(nodes_visited_, 1);
+
+            if (!SearchItems(area_to_search, visitor))
+            {
+                return false;
+            }
+
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                if (children_[i] != nullptr)
+                {
+                    if (area_to_search.Contains(children_[i]->bounds_))
+                    {
+                        QUADTREE_COUNT(subtree_adds_, 1);
+
+                        if (!children_[i]->AddItems(visitor))
+                        {
+                            return false;
+                        }
+                    }
+                    else if (area_to_search.Intersects(children_[i]->bounds_))
+                    {
+                        if (!children_[i]->Search(area_to_search, visitor))
+                        {
+                            return false;
+                        }
+                    }
+                }
+            }
+
+            return true;
+        }
+
+        void CollectStats(quadtree_stats::TreeStats* stats) const
+        {
+            if (stats->nodes_per_depth_.size() <= depth_)
+            {
+                stats->nodes_per_depth_.resize(depth_ + 1, 0);
+                stats->items_per_depth_.resize(depth_ + 1, 0);
+            }
+
+            ++stats->node_count_;
+            ++stats->nodes_per_depth_[depth_];
+            stats->items_per_depth_[depth_] += item_indices_.size();
+            stats->bytes_used_ += sizeof(Node) + item_indices_.capacity() * sizeof(std::uint32_t) + boxes_.Capacity() * 4 * sizeof(float);
+
+            if (split_ && parent_ != nullptr)
+            {
+                stats->straddling_items_ += item_indices_.size();
+            }
+
+            for (const Node* child_ptr : children_)
+            {
+                if (child_ptr != nullptr)
+                {
+                    child_ptr->CollectStats(stats);
+                }
+            }
+        }
+
+        // Appends the subtree in pre-order, so its items end up in one run. Returns the node's index.
+        std::uint32_t Flatten(std::vector<snapshot::Node>* nodes, std::vector<snapshot::Item<T>>* items) const
+        {
+            const std::uint32_t index = static_cast<std::uint32_t>(nodes->size());
+            nodes->push_back({ bounds_, { snapshot::no_child, snapshot::no_child, snapshot::no_child, snapshot::no_child }, 
+            static_cast<std::uint32_t>(items->size()), static_cast<std::uint32_t>(item_indices_.size()), static_cast<std::uint32_t>(count_), 
+            static_cast<std::uint32_t>(depth_) });
+
+            for (std::size_t slot = 0; slot < item_indices_.size(); ++slot)
+            {
+                items->push_back({ ItemAt(slot).bbox_, ItemAt(slot).item_ });
+            }
+
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                if (children_[i] != nullptr)
+                {
+                    const std::uint32_t child_index = children_[i]->Flatten(nodes, items);
+                    (*nodes)[index].children_[i] = child_index;
+                }
+            }
+
+            return index;
+        }
+
+        // Same walk as Search, but a child covered by the area adds its subtree count instead of being visited.
+        template <typename AreaType>
+        std::size_t Count(const AreaType& area_to_search) const
+        {
+            std::size_t count = 0;
+            QUADTREE_COUNT(nodes_visited_, 1);
+
+            ScanItems(area_to_search, [&count](std::size_t)
+                {
+                    ++count;
+                    return true;
+                });
+
+            for (const Node* child_ptr : children_)
+            {
+                if (child_ptr != nullptr)
+                {
+                    if (area_to_search.Contains(child_ptr->bounds_))
+                    {
+                        QUADTREE_COUNT(subtree_adds_, 1);
+                        count += child_ptr->count_;
+                    }
+                    else if (area_to_search.Intersects(child_ptr->bounds_))
+                    {
+                        count += child_ptr->Count(area_to_search);
+                    }
+                }
+            }
+
+            return count;
+        }
+
+        // Front-to-back ray traversal: children are visited in order of where the ray enters them, and
+        // the walk stops as soon as the next child starts beyond the closest hit so far.
+        void RayCast(const Point<float>& origin, const Point<float>& direction, float* t_limit, std::optional<RayHit>* best_hit) const
+        {
+            for (std::size_t i = 0; i < boxes_.Size(); ++i)
+            {
+                float t = 0.0f;
+
+                if (boxes_.Get(i).IntersectRay(origin.x_, origin.y_, direction.x_, direction.y_, 0.0f, *t_limit, &t) && 
+                    (!best_hit->has_value() || t < (*best_hit)->t_))
+                {
+                    *best_hit = RayHit{ ItemAt(i).handle_, t };
+                    *t_limit = t;
+                }
+            }
+
+            std::array<std::pair<float, const Node*>, 4> order;
+            std::size_t order_size = 0;
+
+            for (const Node* child_ptr : children_)
+            {
+                float t = 0.0f;
+
+                if (child_ptr != nullptr && child_ptr->bounds_.IntersectRay(origin.x_, origin.y_, direction.x_, direction.y_, 0.0f, *t_limit, &t))
+                {
+                    order[order_size++] = { t, child_ptr };
+                }
+            }
+
+            std::sort(order.begin(), order.begin() + order_size, [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+
+            for (std::size_t i = 0; i < order_size; ++i)
+            {
+                if (best_hit->has_value() && order[i].first >= (*best_hit)->t_)
+                {
+                    break;
+                }
+
+                order[i].second->RayCast(origin, direction, t_limit, best_hit);
+            }
+        }
+
+        void SegmentQuery(const Point<float>& origin, const Point<float>& direction, std::vector<RayHit>* out_hits) const
+        {
+            for (std::size_t i = 0; i < boxes_.Size(); ++i)
+            {
+                float t = 0.0f;
+
+                if (boxes_.Get(i).IntersectRay(origin.x_, origin.y_, direction.x_, direction.y_, 0.0f, 1.0f, &t))
+                {
+                    out_hits->push_back({ ItemAt(i).handle_, t });
+                }
+            }
+
+            for (const Node* child_ptr : children_)
+            {
+                float t = 0.0f;
+
+                if (child_ptr != nullptr && child_ptr->bounds_.IntersectRay(origin.x_, origin.y_, direction.x_, direction.y_, 0.0f, 1.0f, &t))
+                {
+                    child_ptr->SegmentQuery(origin, direction, out_hits);
+                }
+            }
+        }
+
+        // Reports every overlapping pair with at least one item in this subtree. stack[begin, end) holds
+        // the ancestor items that overlap this node's bounds. In a loose tree sibling bounds overlap, so
+        // pairs split across two children are found by CrossPairs. When tasks is set, subtrees at
+        // split_depth and the sibling cross passes above it are handed out as tasks instead of walked.
+        template <typename Callback>
+        void OverlappingPairs(std::vector<BoxedItem>* stack, std::size_t begin, Callback& callback, bool loose, std::vector<PairTask>* tasks, std::size_t split_depth) const
+        {
+            if (tasks != nullptr && depth_ == split_depth)
+            {
+                tasks->push_back({ this, nullptr, std::vector<BoxedItem>(stack->begin() + begin, stack->end()) });
+                return;
+            }
+
+            const std::size_t end = stack->size();
+
+            for (std::size_t i = 0; i < boxes_.Size(); ++i)
+            {
+                const AABB<float> box = boxes_.Get(i);
+
+                for (std::size_t j = i + 1; j < boxes_.Size(); ++j)
+                {
+                    if (box.Overlaps(boxes_.Get(j)))
+                    {
+                        callback(ItemAt(i), ItemAt(j));
+                    }
+                }
+
+                for (std::size_t k = begin; k < end; ++k)
+                {
+                    if ((*stack)[k].first.Overlaps(box))
+                    {
+                        callback(*(*stack)[k].second, ItemAt(i));
+                    }
+                }
+            }
+
+            for (const Node* child_ptr : children_)
+            {
+                if (child_ptr == nullptr)
+                {
+                    continue;
+                }
+
+                // Only items reaching into the child's bounds can overlap anything below it.
+                const std::size_t child_begin = stack->size();
+
+                for (std::size_t k = begin; k < end; ++k)
+                {
+                    if ((*stack)[k].first.Overlaps(child_ptr->bounds_))
+                    {
+                        stack->push_back((*stack)[k]);
+                    }
+                }
+
+                for (std::size_t i = 0; i < boxes_.Size(); ++i)
+                {
+                    if (boxes_.Get(i).Overlaps(child_ptr->bounds_))
+                    {
+                        stack->push_back({ boxes_.Get(i), &ItemAt(i) });
+                    }
+                }
+
+                child_ptr->OverlappingPairs(stack, child_begin, callback, loose, tasks, split_depth);
+                stack->resize(child_begin);
+            }
+
+            for (std::size_t i = 0; loose && i < 4; ++i)
+            {
+                for (std::size_t j = i + 1; j < 4; ++j)
+                {
+                    if (children_[i] == nullptr || children_[j] == nullptr)
+                    {
+                        continue;
+                    }
+
+                    if (tasks != nullptr)
+                    {
+                        tasks->push_back({ children_[i], children_[j], {} });
+                    }
+                    else
+                    {
+                        children_[i]->CrossPairs(children_[j], callback);
+                    }
+                }
+            }
+        }
+
+        // Pairs with one item in this subtree and the other in other's subtree (disjoint subtrees).
+        template <typename Callback>
+        void CrossPairs(const Node* other, Callback& callback) const
+        {
+            if (!bounds_.Overlaps(other->bounds_))
+            {
+                return;
+            }
+
+            for (std::size_t i = 0; i < boxes_.Size(); ++i)
+            {
+                other->PairsWithItem(boxes_.Get(i), ItemAt(i), callback);
+            }
+
+            for (const Node* child_ptr : children_)
+            {
+                if (child_ptr != nullptr)
+                {
+                    child_ptr->CrossPairs(other, callback);
+                }
+            }
+        }
+
+        template <typename Callback>
+        void PairsWithItem(const AABB<float>& box, const QuadTreeItem& qt_item, Callback& callback) const
+        {
+            if (!box.Overlaps(bounds_))
+            {
+                return;
+            }
+
+            for (std::size_t j = 0; j < boxes_.Size(); ++j)
+            {
+                if (box.Overlaps(boxes_.Get(j)))
+                {
+                    callback(qt_item, ItemAt(j));
+                }
+            }
+
+            for (const Node* child_ptr : children_)
+            {
+                if (child_ptr != nullptr)
+                {
+                    child_ptr->PairsWithItem(box, qt_item, callback);
+                }
+            }
+        }
+
+        void GetAreas(std::vector<Rect<float>>* out_areas)
+        {
+            const bool all_children_empty = std::all_of(children_.begin(), children_.end(), [](const Node* child_ptr)
+                {
+                    return child_ptr == nullptr;
+                });
+
+            if (all_children_empty)
+            {
+                return;
+            }
+
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                out_areas->push_back(Rect<float>(ChildArea(i)));
+            }
+
+            std::for_each(children_.begin(), children_.end(), [out_areas](Node* child_ptr)
+                {
+                    if (child_ptr != nullptr)
+                    {
+                        child_ptr->GetAreas(out_areas);
+                    }
+                });
+        }
+
+        bool CleanUp()
+        {
+            prune_queued_ = false;
+            const bool northwest = children_[0] == nullptr || children_[0]->CleanUp();
+            const bool northeast = children_[1] == nullptr || children_[1]->CleanUp();
+            const bool southwest = children_[2] == nullptr || children_[2]->CleanUp();
+            const bool southeast = children_[3] == nullptr || children_[3]->CleanUp();
+
+            if (northwest)
+            {
+                DestroyChild(0);
+            }
+
+            if (northeast)
+            {
+                DestroyChild(1);
+            }
+
+            if (southwest)
+            {
+                DestroyChild(2);
+            }
+
+            if (southeast)
+            {
+                DestroyChild(3);
+            }
+
+            return northwest && northeast && southwest && southeast && item_indices_.empty();
+        }
+    };
+
+    // Nodes and per-node item slots are carved out of this pool, so steady-state Insert/Remove churn
+    // recycles blocks from its free lists instead of hitting the heap. Declared first so it outlives
+    // everything allocated from it.
+    std::pmr::unsynchronized_pool_resource pool_;
+    // Resources of the subtrees built concurrently by a parallel bulk load, since pool_ cannot be shared
+    // between threads. Their nodes keep using them afterwards. Keyed by the cell's quadrant path and
+    // depth, so a cell freed and later rebuilt reuses its resource and they stay bounded by the cells.
+    std::unordered_map<std::uint64_t, std::unique_ptr<std::pmr::unsynchronized_pool_resource>> subtree_pools_;
+    QuadTreeConfig config_;
+    Node* root_;
+    // Items are kept dense and removed by swap-and-pop; handles find them through handles_, whose free
+    // slots form a list threaded through dense_index_ starting at free_handle_.
+    std::vector<QuadTreeItem> items_;
+    std::vector<HandleSlot> handles_;
+    std::uint32_t free_handle_;
+    // Cells of nodes emptied while cleanup is deferred, as (Z-order code, depth) of their quadrant path.
+    // Nodes may be freed or refilled before Compact() gets to them, so they are looked up again then.
+    std::vector<std::pair<std::uint64_t, std::size_t>> pending_prunes_;
+    // Scratch of RelocateMany, kept to reuse its capacity.
+    std::vector<std::pair<std::uint64_t, std::size_t>> relocate_order_;
+    std::vector<std::pair<ItemHandle, Rect<float>>> relocate_moves_;
+
+    Node* CreateRoot(const AABB<float>& area)
+    {
+        return NodeAllocator(&pool_).template new_object<Node>(nullptr, 0, area, config_.looseness_, &items_, &pool_);
+    }
+
+    // Appends an item, not yet placed in any node, and returns its position in items_.
+    std::uint32_t EmplaceItem(const T& item, const AABB<float>& bbox)
+    {
+        const std::uint32_t item_index = static_cast<std::uint32_t>(items_.size());
+        ItemHandle handle;
+
+        if (free_handle_ == no_index)
+        {
+            handle = { static_cast<std::uint32_t>(handles_.size()), 0 };
+            handles_.push_back({ item_index, 0 });
+        }
+        else
+        {
+            HandleSlot& slot = handles_[free_handle_];
+            handle = { free_handle_, slot.generation_ };
+            free_handle_ = slot.dense_index_;
+            slot.dense_index_ = item_index;
+        }
+
+        items_.push_back({ item, bbox, nullptr, 0, handle });
+        return item_index;
+    }
+
+    void FreeHandle(const ItemHandle& handle)
+    {
+        HandleSlot& slot = handles_[handle.index_];
+        ++slot.generation_;
+        slot.dense_index_ = free_handle_;
+        free_handle_ = handle.index_;
+    }
+
+    // Drops an item already taken out of its node. The last item moves into its place, so the handle
+    // slot and node slot of that item are patched.
+    void EraseItem(std::uint32_t item_index)
+    {
+        FreeHandle(items_[item_index].handle_);
+
+        if (item_index + 1 != items_.size())
+        {
+            QuadTreeItem& moved = items_[item_index];
+            moved = std::move(items_.back());
+            handles_[moved.handle_.index_].dense_index_ = item_index;
+            moved.node_->item_indices_[moved.node_slot_] = item_index;
+        }
+
+        items_.pop_back();
+    }
+
+    std::uint32_t IndexOf(const ItemHandle& handle) const
+    {
+        if (handle.index_ >= handles_.size() || handles_[handle.index_].generation_ != handle.generation_)
+        {
+            return no_index;
+        }
+
+        return handles_[handle.index_].dense_index_;
+    }
+
+    // Depth whose subtrees are handed to pool as independent tasks: enough of them for every worker to
+    // get several, so uneven ones balance out. 0 when there is no pool or a single worker.
+    std::size_t SplitDepthFor(const ThreadPool* pool) const
+    {
+        std::size_t split_depth = 0;
+
+        if (pool != nullptr && pool->Size() > 1)
+        {
+            for (std::size_t subtrees = 1; subtrees < pool->Size() * 8 && split_depth < config_.max_depth_; subtrees *= 4)
+            {
+                ++split_depth;
+            }
+        }
+
+        return split_depth;
+    }
+
+    // Sort key of an item for a bulk load: the Z-order code of the quadrant path its center takes down
+    // to the cell it ends up in, left-aligned so parents sort before their subtrees, with the depth in
+    // the low 6 bits.
+    std::uint64_t BulkKey(const AABB<float>& bbox) const
+    {
+        const std::size_t max_depth = config_.max_depth_;
+        AABB<float> area = root_->area_;
+        std::uint64_t code = 0;
+        std::size_t depth = 0;
+
+        for (; depth < max_depth; ++depth)
+        {
+            const std::size_t child_index = ChildIndexOf(area, bbox, config_.looseness_);
+
+            if (child_index == 4)
+            {
+                break;
+            }
+
+            code = morton::Push(code, child_index);
+            area = ChildAreaOf(area, child_index);
+        }
+
+        return ((code << (2 * (max_depth - depth))) << 6) | depth;
+    }
+
+    // Creates the nodes on the way to the cells of entries[begin, end) and adds the items, walking the
+    // sorted entries once and marking the nodes below base it passes for FinishBulk. All entries must
+    // lie in base's subtree, base being reached by base_code; the nodes above base are the caller's to mark.
+    void PlaceSorted(Node* base, std::uint64_t base_code, const std::vector<morton::Entry>& entries, std::size_t begin, std::size_t end) const
+    {
+        const std::size_t max_depth = config_.max_depth_;
+        const std::size_t base_depth = base->depth_;
+        std::array<Node*, 30> path = {};
+        path[base_depth] = base;
+        std::size_t path_depth = base_depth;
+        std::uint64_t path_code = base_code;
+
+        for (std::size_t run_begin = begin, run_end = begin; run_begin < end; run_begin = run_end)
+        {
+            // Equal keys target the same node, so each run is placed with a single reservation.
+            const std::uint64_t key = entries[run_begin].key_;
+
+            while (run_end < end && entries[run_end].key_ == key)
+            {
+                ++run_end;
+            }
+
+            const std::size_t depth = key & 63;
+            const std::uint64_t code = (key >> 6) >> (2 * (max_depth - depth));
+            std::size_t common = std::min(path_depth, depth);
+
+            while (common > base_depth && (code >> (2 * (depth - common))) != (path_code >> (2 * (path_depth - common))))
+            {
+                --common;
+            }
+
+            for (path_depth = common; path_depth < depth; ++path_depth)
+            {
+                path[path_depth + 1] = path[path_depth]->GetOrCreateChild(morton::QuadrantAt(code, depth, path_depth + 1), config_.looseness_);
+                path[path_depth + 1]->bulk_touched_ = true;
+            }
+
+            path_code = code;
+            Node* node = path[depth];
+            node->ReserveItems(node->item_indices_.size() + (run_end - run_begin));
+
+            for (std::size_t i = run_begin; i < run_end; ++i)
+            {
+                node->AddItem(entries[i].index_);
+            }
+        }
+    }
+
+    // Takes one item off the subtree counts from node up to, but not including, stop. Returns the
+    // highest of those nodes that is split and dropped to the merge threshold, or nullptr.
+    Node* UncountItem(Node* node, const Node* stop)
+    {
+        Node* merge_target = nullptr;
+
+        for (Node* path_node = node; path_node != stop; path_node = path_node->parent_)
+        {
+            --path_node->count_;
+
+            if (config_.node_capacity_ > 0 && path_node->split_ && path_node->count_ <= config_.merge_threshold_)
+            {
+                merge_target = path_node;
+            }
+        }
+
+        return merge_target;
+    }
+
+    // Takes the item out of its node and the subtree counts on the way up, then collapses the
+    // highest ancestor that dropped to the merge threshold. Returns the node left without items that
+    // the caller may want to prune (the collapsed ancestor if it ended up empty), or nullptr.
+    Node* Detach(std::uint32_t item_index)
+    {
+        Node* node = items_[item_index].node_;
+        node->RemoveItem(item_index);
+        Node* merge_target = UncountItem(node, nullptr);
+
+        if (merge_target != nullptr)
+        {
+            merge_target->Collapse();
+            return merge_target->count_ == 0 ? merge_target : nullptr;
+        }
+
+        return node->item_indices_.empty() ? node : nullptr;
+    }
+
+    // Frees the largest empty subtree containing node, found by climbing parent_ while the subtree
+    // counts stay zero. Only the path to the root is touched.
+    void Prune(Node* node)
+    {
+        if (node->count_ != 0)
+        {
+            return;
+        }
+
+        while (node->parent_ != nullptr && node->parent_ != root_ && node->parent_->count_ == 0)
+        {
+            node = node->parent_;
+        }
+
+        if (node != root_)
+        {
+            node->parent_->DestroyChild(node->IndexInParent());
+        }
+    }
+
+    void ReleaseIfEmpty(Node* node)
+    {
+        if (node->count_ != 0)
+        {
+            return;
+        }
+
+        if (!config_.deferred_cleanup_ || node->depth_ > 32)
+        {
+            Prune(node);
+            return;
+        }
+
+        if (node->prune_queued_)
+        {
+            return;
+        }
+
+        node->prune_queued_ = true;
+
+        std::uint64_t code = 0;
+
+        for (const Node* path_node = node; path_node->parent_ != nullptr; path_node = path_node->parent_)
+        {
+            code |= static_cast<std::uint64_t>(path_node->IndexInParent()) << (2 * (node->depth_ - path_node->depth_));
+        }
+
+        pending_prunes_.emplace_back(code, node->depth_);
+    }
+
+public:
+    QuadTree(const Rect<float>& area, const std::size_t max_depth) : QuadTree(area, QuadTreeConfig{ max_depth, 0, 0 })
+    {
+    }
+
+    QuadTree(const Rect<float>& area, const QuadTreeConfig& config) : config_(config), root_(nullptr), free_handle_(no_index)
+    {
+        assert(config_.node_capacity_ == 0 || config_.merge_threshold_ < config_.node_capacity_);
+        assert(config_.looseness_ >= 1.0f);
+        root_ = CreateRoot(area.GetBounds());
+    }
+
+    template <typename Range>
+    QuadTree(const Rect<float>& area, const QuadTreeConfig& config, const Range& range, ThreadPool* pool = nullptr) : QuadTree(area, config)
+    {
+        InsertBulk(range, pool);
+    }
+
+    ~QuadTree()
+    {
+        NodeAllocator(&pool_).delete_object(root_);
+    }
+
+    QuadTree(const QuadTree&) = delete;
+    QuadTree& operator=(const QuadTree&) = delete;
+
+    void Resize(const Rect<float>& area)
+    {
+        Reset();
+        root_->area_ = area.GetBounds();
+        root_->bounds_ = Loosen(root_->area_, config_.looseness_);
+    }
+
+    void Reset()
+    {
+        const AABB<float> root_area = root_->area_;
+        NodeAllocator(&pool_).delete_object(root_);
+        subtree_pools_.clear();
+        pending_prunes_.clear();
+        pool_.release();
+
+        // Handles stay allocated, so ones taken before the reset are still recognized as stale.
+        for (const QuadTreeItem& qt_item : items_)
+        {
+            FreeHandle(qt_item.handle_);
+        }
+
+        items_.clear();
+
+        root_ = CreateRoot(root_area);
+    }
+
+    std::size_t Size() const
+    {
+        return items_.size();
+    }
+
+    bool Empty() const
+    {
+        return items_.empty();
+    }
+
+    ItemHandle Insert(const T& item, const Rect<float>& item_bbox)
+    {
+        if (item_bbox.top_left_.x_ < 0 || item_bbox.top_left_.x_ > root_->area_.max_x_ || 
+        item_bbox.top_left_.y_ < 0 || item_bbox.top_left_.y_ > root_->area_.max_y_)
+        {
+            printf("%s%f%s%f%s\n", "Failed to insert! Position: x { ", item_bbox.top_left_.x_, " } y { ", item_bbox.top_left_.y_, " } is out of bounds!");
+        }
+
+        const std::uint32_t item_index = EmplaceItem(item, item_bbox.GetBounds());
+        root_->Insert(item_index, config_);
+        return items_[item_index].handle_;
+    }
+
+    // The item a handle refers to, or nullptr once it was removed.
+    QuadTreeItem* Get(const ItemHandle& handle)
+    {
+        const std::uint32_t item_index = IndexOf(handle);
+        return item_index == no_index ? nullptr : &items_[item_index];
+    }
+
+    const QuadTreeItem* Get(const ItemHandle& handle) const
+    {
+        const std::uint32_t item_index = IndexOf(handle);
+        return item_index == no_index ? nullptr : &items_[item_index];
+    }
+
+    bool Contains(const ItemHandle& handle) const
+    {
+        return IndexOf(handle) != no_index;
+    }
+
+    // Inserts every (item, Rect<float> bbox) pair of range in one pass. Each item's target cell is
+    // computed without touching nodes and encoded as the Z-order code of its center's quadrant path,
+    // the codes are radix sorted and the nodes are then created and filled in depth-first order while
+    // walking the sorted list once. Queries see the same items as after inserting one by one.
+    //
+    // Only the nodes on the paths to the new items are finished afterwards, so loading into a large
+    // tree in batches costs each batch about its own size. With a pool, the keys are computed in
+    // parallel and the sorted list is cut into the independent subtrees below a split depth, each
+    // built and finished as a task on its own memory resource. Only the few levels above are assembled
+    // on the calling thread, along with the subtrees that already exist on a resource shared with
+    // their parent, e.g. ones grown by Insert.
+    template <typename Range>
+    void InsertBulk(const Range& range, ThreadPool* pool = nullptr)
+    {
+        const std::size_t max_depth = config_.max_depth_;
+
+        if (max_depth > 29)
+        {
+            // The code plus a 6 bit depth must fit in 64 bits.
+            for (const auto& [item, item_bbox] : range)
+            {
+                Insert(item, item_bbox);
+            }
+
+            return;
+        }
+
+        const std::size_t first = items_.size();
+
+        for (const auto& [item, item_bbox] : range)
+        {
+            EmplaceItem(item, item_bbox.GetBounds());
+        }
+
+        std::vector<morton::Entry> entries(items_.size() - first);
+
+        auto compute_keys = [this, &entries, first](std::size_t begin, std::size_t end, std::size_t)
+            {
+                for (std::size_t i = begin; i < end; ++i)
+                {
+                    entries[i] = { BulkKey(items_[first + i].bbox_), static_cast<std::uint32_t>(first + i) };
+                }
+            };
+
+        const std::size_t split_depth = SplitDepthFor(pool);
+
+        if (split_depth == 0)
+        {
+            compute_keys(0, entries.size(), 0);
+            morton::SortByKey(entries);
+            PlaceSorted(root_, 0, entries, 0, entries.size());
+            root_->FinishBulk(config_);
+            return;
+        }
+
+        pool->ParallelForRange(entries.size(), 4096, compute_keys);
+        morton::SortByKey(entries);
+
+        // Items above the split depth are placed here; every run of deeper items sharing a cell at the
+        // split depth becomes a task, with a missing cell created up front on the task's resource. An
+        // existing cell can only be built in parallel if it is the top of such a resource.
+        struct BuildTask
+        {
+            Node* node_;
+            std::uint64_t code_;
+            std::size_t begin_;
+            std::size_t end_;
+        };
+
+        std::vector<morton::Entry> shallow;
+        std::vector<BuildTask> tasks;
+        std::vector<BuildTask> shared_tasks;
+        const std::size_t prefix_shift = 6 + 2 * (max_depth - split_depth);
+
+        for (std::size_t run_begin = 0, run_end = 0; run_begin < entries.size(); run_begin = run_end)
+        {
+            if ((entries[run_begin].key_ & 63) < split_depth)
+            {
+                shallow.push_back(entries[run_begin]);
+                run_end = run_begin + 1;
+                continue;
+            }
+
+            const std::uint64_t prefix = entries[run_begin].key_ >> prefix_shift;
+
+            while (run_end < entries.size() && (entries[run_end].key_ & 63) >= split_depth && (entries[run_end].key_ >> prefix_shift) == prefix)
+            {
+                ++run_end;
+            }
+
+            Node* node = root_;
+            root_->bulk_touched_ = true;
+
+            for (std::size_t level = 1; level < split_depth; ++level)
+            {
+                node = node->GetOrCreateChild(morton::QuadrantAt(prefix, split_depth, level), config_.looseness_);
+                node->bulk_touched_ = true;
+            }
+
+            const std::size_t cell_index = morton::QuadrantAt(prefix, split_depth, split_depth);
+            Node* cell = node->children_[cell_index];
+
+            if (cell == nullptr)
+            {
+                std::unique_ptr<std::pmr::unsynchronized_pool_resource>& cell_pool = subtree_pools_[(prefix << 6) | split_depth];
+
+                if (cell_pool == nullptr)
+                {
+                    cell_pool = std::make_unique<std::pmr::unsynchronized_pool_resource>();
+                }
+                else
+                {
+                    // Only the cell's subtree allocates from it, and that was freed with the cell.
+                    cell_pool->release();
+                }
+
+                cell = node->GetOrCreateChild(cell_index, config_.looseness_, cell_pool.get());
+            }
+
+            const bool own_resource = cell->item_indices_.get_allocator().resource() != node->item_indices_.get_allocator().resource();
+            (own_resource ? tasks : shared_tasks).push_back({ cell, prefix, run_begin, run_end });
+        }
+
+        PlaceSorted(root_, 0, shallow, 0, shallow.size());
+
+        auto build = [this, &entries](const BuildTask& task)
+            {
+                PlaceSorted(task.node_, task.code_, entries, task.begin_, task.end_);
+                task.node_->FinishBulk(config_);
+            };
+
+        pool->ParallelFor(tasks.size(), [&build, &tasks](std::size_t task_index, std::size_t)
+            {
+                build(tasks[task_index]);
+            });
+
+        std::for_each(shared_tasks.begin(), shared_tasks.end(), build);
+        root_->FinishBulk(config_);
+    }
+
+    // Empty nodes left behind are freed by walking up from the item's node, or queued for Compact() with
+    // deferred cleanup. Returns false if the handle was stale.
+    bool Remove(const ItemHandle& handle)
+    {
+        const std::uint32_t item_index = IndexOf(handle);
+
+        if (item_index == no_index)
+        {
+            return false;
+        }
+
+        Node* emptied = Detach(item_index);
+        EraseItem(item_index);
+
+        if (emptied != nullptr)
+        {
+            ReleaseIfEmpty(emptied);
+        }
+
+        return true;
+    }
+
+    // An item leaving its node is reinserted from the nearest ancestor whose area holds its center and
+    // whose bounds hold the whole box, so only the counts below that ancestor change. With looseness_
+    // above 1 this can place it elsewhere than an insert from the root would, but always in a node
+    // whose bounds contain it, which is all queries rely on. Returns false if the handle was stale.
+    bool Relocate(const ItemHandle& handle, const Rect<float>& new_area)
+    {
+        const std::uint32_t item_index = IndexOf(handle);
+
+        if (item_index == no_index)
+        {
+            return false;
+        }
+
+        const AABB<float> new_bbox = new_area.GetBounds();
+        QuadTreeItem& qt_item = items_[item_index];
+        Node* node = qt_item.node_;
+        const bool area_contains = node->parent_ == nullptr || node->bounds_.Contains(new_bbox);
+
+        if (area_contains && (!node->split_ || node->ChildIndexFor(new_bbox, config_.looseness_) == 4))
+        {
+            qt_item.bbox_ = new_bbox;
+            node->boxes_.Set(qt_item.node_slot_, new_bbox);
+            return true;
+        }
+
+        const float center_x = new_bbox.min_x_ + (new_bbox.GetWidth() / 2.0f);
+        const float center_y = new_bbox.min_y_ + (new_bbox.GetHeight() / 2.0f);
+        Node* ancestor = node;
+
+        while (ancestor->parent_ != nullptr && !(ancestor->bounds_.Contains(new_bbox) && 
+        center_x >= ancestor->area_.min_x_ && center_x < ancestor->area_.max_x_ && center_y >= ancestor->area_.min_y_ && center_y < ancestor->area_.max_y_))
+        {
+            ancestor = ancestor->parent_;
+        }
+
+        node->RemoveItem(item_index);
+        Node* merge_target = UncountItem(node, ancestor);
+
+        // Insert counts the item at the ancestor again.
+        --ancestor->count_;
+
+        if (merge_target != nullptr)
+        {
+            merge_target->Collapse();
+        }
+
+        qt_item.bbox_ = new_bbox;
+        ancestor->Insert(item_index, config_);
+
+        // Released only after reinserting, in case the item came straight back into the same node.
+        // A collapse may have freed node, leaving the collapsed subtree as the one to check.
+        Node* emptied = merge_target != nullptr ? merge_target : node;
+
+        if (emptied->count_ == 0)
+        {
+            ReleaseIfEmpty(emptied);
+        }
+
+        return true;
+    }
+
+    // Applies a range of (ItemHandle, Rect<float> new bbox) moves ordered by where the items currently
+    // are, so consecutive moves walk nearby nodes. Moves of the same item keep their relative order and
+    // stale handles are skipped.
+    template <typename Range>
+    void RelocateMany(const Range& moves)
+    {
+        relocate_order_.clear();
+        relocate_moves_.clear();
+
+        for (const auto& [handle, new_area] : moves)
+        {
+            const QuadTreeItem* qt_item = Get(handle);
+            relocate_order_.emplace_back(qt_item != nullptr ? ZOrderKey(qt_item->bbox_) : 0, relocate_order_.size());
+            relocate_moves_.emplace_back(handle, new_area);
+        }
+
+        std::sort(relocate_order_.begin(), relocate_order_.end());
+
+        for (const auto& [key, index] : relocate_order_)
+        {
+            Relocate(relocate_moves_[index].first, relocate_moves_[index].second);
+        }
+    }
+
+    // Z-order code of the bbox center on a 65536 x 65536 grid over the tree's area, in the same order
+    // as the quadrant paths, for sorting work by locality.
+    std::uint64_t ZOrderKey(const AABB<float>& bbox) const
+    {
+        const AABB<float>& area = root_->area_;
+        const float scale_x = area.GetWidth() > 0.0f ? 65535.0f / area.GetWidth() : 0.0f;
+        const float scale_y = area.GetHeight() > 0.0f ? 65535.0f / area.GetHeight() : 0.0f;
+        const float x = std::clamp(((bbox.min_x_ + bbox.max_x_) * 0.5f - area.min_x_) * scale_x, 0.0f, 65535.0f);
+        const float y = std::clamp(((bbox.min_y_ + bbox.max_y_) * 0.5f - area.min_y_) * scale_y, 0.0f, 65535.0f);
+        return morton::Encode(static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y));
+    }
+
+    // Full sweep freeing every empty node. Remove and Relocate already free what they empty, so this
+    // is only needed to flush deferred cleanup at once.
+    void CleanUp()
+    {
+        root_->CleanUp();
+        pending_prunes_.clear();
+    }
+
+    // Frees up to max_nodes of the nodes queued by deferred cleanup, most recent first, each costing a
+    // walk of its depth. Nodes refilled or already gone in the meantime are skipped; a refilled node
+    // stays marked as queued until then, so emptying it again does not queue it twice. Returns how many
+    // are still queued.
+    std::size_t Compact(std::size_t max_nodes)
+    {
+        for (std::size_t processed = 0; processed < max_nodes && !pending_prunes_.empty(); ++processed)
+        {
+            const auto [code, depth] = pending_prunes_.back();
+            pending_prunes_.pop_back();
+            Node* node = root_;
+
+            for (std::size_t level = 1; level <= depth && node != nullptr; ++level)
+            {
+                node = node->children_[morton::QuadrantAt(code, depth, level)];
+            }
+
+            if (node != nullptr)
+            {
+                node->prune_queued_ = false;
+                Prune(node);
+            }
+        }
+
+        return pending_prunes_.size();
+    }
+
+    // Calls visitor for every item intersecting area_to_search without allocating. Returns false if the
+    // visitor stopped the query early by returning false. AreaType is a concrete shape (Rect, Circle), so
+    // the intersection tests in the traversal are resolved statically.
+    template <typename AreaType, typename Visitor>
+    bool Query(const AreaType& area_to_search, Visitor visitor) const
+    {
+        return root_->Search(area_to_search, visitor);
+    }
+
+    // Shapes only known through the base class are dispatched to the concrete type once per query.
+    template <typename Visitor>
+    bool Query(const Shape<float>& area_to_search, Visitor visitor) const
+    {
+        switch (area_to_search.shape_type_)
+        {
+            case ShapeType::RECT:
+                return Query(static_cast<const Rect<float>&>(area_to_search), visitor);
+            case ShapeType::CIRCLE:
+                return Query(static_cast<const Circle<float>&>(area_to_search), visitor);
+            default:
+                return root_->Search(area_to_search, visitor);
+        }
+    }
+
+    // Lazy counterpart of Query for concrete shapes, e.g. qt.SearchLazy(rect) | std::views::take(1).
+    template <typename AreaType>
+    QueryRange<AreaType> SearchLazy(const AreaType& area_to_search) const
+    {
+        return QueryRange<AreaType>(root_, config_.max_depth_, area_to_search);
+    }
+
+    // Number of items intersecting area_to_search, without visiting the items of subtrees it covers.
+    template <typename AreaType>
+    std::size_t Count(const AreaType& area_to_search) const
+    {
+        return root_->Count(area_to_search);
+    }
+
+    std::size_t Count(const Shape<float>& area_to_search) const
+    {
+        switch (area_to_search.shape_type_)
+        {
+            case ShapeType::RECT:
+                return Count(static_cast<const Rect<float>&>(area_to_search));
+            case ShapeType::CIRCLE:
+                return Count(static_cast<const Circle<float>&>(area_to_search));
+            default:
+                return root_->Count(area_to_search);
+        }
+    }
+
+    std::size_t Count(const std::unique_ptr<Shape<float>>& area_to_search) const
+    {
+        return area_to_search != nullptr ? Count(*area_to_search) : 0;
+    }
+
+    // Appends the matches to a caller-owned vector so its capacity can be reused between queries.
+    template <typename AreaType>
+    void Search(const AreaType& area_to_search, std::vector<ItemHandle>* out_items) const
+    {
+        if (out_items == nullptr)
+        {
+            return;
+        }
+
+        Query(area_to_search, [out_items](const QuadTreeItem& qt_item)
+            {
+                out_items->push_back(qt_item.handle_);
+            });
+    }
+
+    void Search(const std::unique_ptr<Shape<float>>& area_to_search, std::vector<ItemHandle>* out_items) const
+    {
+        if (area_to_search != nullptr)
+        {
+            Search(*area_to_search, out_items);
+        }
+    }
+
+    std::list<ItemHandle> Search(const std::unique_ptr<Shape<float>>& area_to_search) const
+    {
+        std::list<ItemHandle> items_list;
+
+        if (area_to_search != nullptr)
+        {
+            Query(*area_to_search, [&items_list](const QuadTreeItem& qt_item)
+                {
+                    items_list.push_back(qt_item.handle_);
+                });
+        }
+
+        return items_list;
+    }
+
+    // Runs every query of the batch, spread over the pool in chunks that idle workers steal from each
+    // other. Matches go to per-worker buffers first and are then copied in query order into the flat
+    // result, so no query allocates. The tree must not be modified while the batch runs. Without a pool
+    // the batch runs on the calling thread.
+    template <typename AreaType>
+    void SearchBatch(std::span<const AreaType> queries, BatchResult* result, ThreadPool* pool = nullptr) const
+    {
+        if (result == nullptr)
+        {
+            return;
+        }
+
+        const std::size_t worker_count = pool == nullptr ? 1 : pool->Size();
+        result->worker_items_.resize(std::max(result->worker_items_.size(), worker_count));
+
+        for (std::vector<ItemHandle>& worker_items : result->worker_items_)
+        {
+            worker_items.clear();
+        }
+
+        result->offsets_.assign(queries.size() + 1, 0);
+        result->local_offsets_.resize(queries.size());
+        result->workers_.resize(queries.size());
+
+        // Queries vary a lot in cost, so chunks stay small enough for stealing to even them out.
+        const std::size_t grain = 16;
+
+        auto run_queries = [this, queries, result](std::size_t begin, std::size_t end, std::size_t worker)
+            {
+                std::vector<ItemHandle>& worker_items = result->worker_items_[worker];
+
+                for (std::size_t query_index = begin; query_index < end; ++query_index)
+                {
+                    const std::size_t local_offset = worker_items.size();
+                    Search(queries[query_index], &worker_items);
+                    result->local_offsets_[query_index] = local_offset;
+                    result->workers_[query_index] = static_cast<std::uint32_t>(worker);
+                    result->offsets_[query_index + 1] = worker_items.size() - local_offset;
+                }
+            };
+
+        if (pool == nullptr)
+        {
+            run_queries(0, queries.size(), 0);
+        }
+        else
+        {
+            pool->ParallelForRange(queries.size(), grain, run_queries);
+        }
+
+        for (std::size_t query_index = 0; query_index < queries.size(); ++query_index)
+        {
+            result->offsets_[query_index + 1] += result->offsets_[query_index];
+        }
+
+        result->items_.resize(result->offsets_.back());
+
+        auto gather = [result](std::size_t begin, std::size_t end, std::size_t)
+            {
+                for (std::size_t query_index = begin; query_index < end; ++query_index)
+                {
+                    const std::vector<ItemHandle>& worker_items = result->worker_items_[result->workers_[query_index]];
+                    const std::size_t count = result->offsets_[query_index + 1] - result->offsets_[query_index];
+                    std::copy_n(worker_items.begin() + result->local_offsets_[query_index], count, result->items_.begin() + result->offsets_[query_index]);
+                }
+            };
+
+        if (pool == nullptr)
+        {
+            gather(0, queries.size(), 0);
+        }
+        else
+        {
+            pool->ParallelForRange(queries.size(), grain * 4, gather);
+        }
+    }
+
+    template <typename AreaType>
+    void SearchBatch(const std::vector<AreaType>& queries, BatchResult* result, ThreadPool* pool = nullptr) const
+    {
+        SearchBatch(std::span<const AreaType>(queries), result, pool);
+    }
+
+    // Up to k items closest to point (distance to their bbox, 0 if inside) within max_distance, sorted
+    // nearest first. Nodes are expanded best-first by the distance to their bounds, and the search
+    // stops once the closest unexpanded node is farther than the current k-th candidate.
+    void KNearest(const Point<float>& point, std::size_t k, float max_distance, std::vector<Neighbor>* out_neighbors) const
+    {
+        if (out_neighbors == nullptr || k == 0)
+        {
+            return;
+        }
+
+        typedef std::pair<float, const Node*> NodeEntry;
+        typedef std::pair<float, ItemHandle> Candidate;
+
+        const auto candidate_less = [](const Candidate& lhs, const Candidate& rhs) { return lhs.first < rhs.first; };
+        std::vector<NodeEntry> frontier;
+        std::vector<Candidate> candidates;
+        float limit = max_distance == std::numeric_limits<float>::infinity() ? max_distance : max_distance * max_distance;
+
+        frontier.push_back({ 0.0f, root_ });
+
+        while (!frontier.empty())
+        {
+            std::pop_heap(frontier.begin(), frontier.end(), std::greater<NodeEntry>());
+            const auto [node_distance, node] = frontier.back();
+            frontier.pop_back();
+
+            if (node_distance > limit)
+            {
+                break;
+            }
+
+            for (std::size_t i = 0; i < node->boxes_.Size(); ++i)
+            {
+                const float distance = node->boxes_.Get(i).DistanceSquared(point.x_, point.y_);
+
+                if (candidates.size() < k ? distance <= limit : distance < limit)
+                {
+                    if (candidates.size() == k)
+                    {
+                        std::pop_heap(candidates.begin(), candidates.end(), candidate_less);
+                        candidates.pop_back();
+                    }
+
+                    candidates.push_back({ distance, node->ItemAt(i).handle_ });
+                    std::push_heap(candidates.begin(), candidates.end(), candidate_less);
+
+                    if (candidates.size() == k)
+                    {
+                        limit = candidates.front().first;
+                    }
+                }
+            }
+
+            for (const Node* child_ptr : node->children_)
+            {
+                if (child_ptr != nullptr)
+                {
+                    const float child_distance = child_ptr->bounds_.DistanceSquared(point.x_, point.y_);
+
+                    if (child_distance <= limit)
+                    {
+                        frontier.push_back({ child_distance, child_ptr });
+                        std::push_heap(frontier.begin(), frontier.end(), std::greater<NodeEntry>());
+                    }
+                }
+            }
+        }
+
+        std::sort_heap(candidates.begin(), candidates.end(), candidate_less);
+
+        for (const Candidate& candidate : candidates)
+        {
+            out_neighbors->push_back({ candidate.second, std::sqrt(candidate.first) });
+        }
+    }
+
+    std::vector<Neighbor> KNearest(const Point<float>& point, std::size_t k, float max_distance = std::numeric_limits<float>::infinity()) const
+    {
+        std::vector<Neighbor> neighbors;
+        KNearest(point, k, max_distance, &neighbors);
+        return neighbors;
+    }
+
+    std::optional<Neighbor> Nearest(const Point<float>& point, float max_distance = std::numeric_limits<float>::infinity()) const
+    {
+        std::vector<Neighbor> neighbors;
+        KNearest(point, 1, max_distance, &neighbors);
+
+        if (neighbors.empty())
+        {
+            return std::nullopt;
+        }
+
+        return neighbors.front();
+    }
+
+    // First item hit by origin + t * direction for t in [0, max_t]. t is in units of direction, so a
+    // unit direction gives distances.
+    std::optional<RayHit> RayCast(const Point<float>& origin, const Point<float>& direction, float max_t = std::numeric_limits<float>::infinity()) const
+    {
+        std::optional<RayHit> best_hit;
+        root_->RayCast(origin, direction, &max_t, &best_hit);
+        return best_hit;
+    }
+
+    // Every item touched by the segment from start to end, ordered by t in [0, 1] along the segment.
+    void SegmentQuery(const Point<float>& start, const Point<float>& end, std::vector<RayHit>* out_hits) const
+    {
+        if (out_hits == nullptr)
+        {
+            return;
+        }
+
+        const std::size_t first = out_hits->size();
+        root_->SegmentQuery(start, end - start, out_hits);
+        std::sort(out_hits->begin() + first, out_hits->end(), [](const RayHit& lhs, const RayHit& rhs) { return lhs.t_ < rhs.t_; });
+    }
+
+    std::vector<RayHit> SegmentQuery(const Point<float>& start, const Point<float>& end) const
+    {
+        std::vector<RayHit> hits;
+        SegmentQuery(start, end, &hits);
+        return hits;
+    }
+
+    // Calls callback(a, b) once for every pair of items whose boxes overlap (edges included). Each
+    // node's items are tested against each other and against the ancestor items reaching into the
+    // node, so shared ancestors are not revisited per item and no pair is reported twice.
+    template <typename Callback>
+    void ForEachOverlappingPair(Callback callback) const
+    {
+        std::vector<BoxedItem> stack;
+        root_->OverlappingPairs(&stack, 0, callback, config_.looseness_ > 1.0f, nullptr, 0);
+    }
+
+    // Same pairs, with the subtrees below a split depth processed on the pool. callback is invoked
+    // concurrently from several threads and must be safe to call that way.
+    template <typename Callback>
+    void ForEachOverlappingPair(Callback callback, ThreadPool* pool) const
+    {
+        const std::size_t split_depth = SplitDepthFor(pool);
+
+        if (split_depth == 0)
+        {
+            ForEachOverlappingPair(callback);
+            return;
+        }
+
+        std::vector<BoxedItem> stack;
+        std::vector<PairTask> tasks;
+        const bool loose = config_.looseness_ > 1.0f;
+        root_->OverlappingPairs(&stack, 0, callback, loose, &tasks, split_depth);
+
+        pool->ParallelFor(tasks.size(), [&tasks, &callback, loose](std::size_t task_index, std::size_t)
+            {
+                PairTask& task = tasks[task_index];
+
+                if (task.other_ != nullptr)
+                {
+                    task.node_->CrossPairs(task.other_, callback);
+                }
+                else
+                {
+                    task.node_->OverlappingPairs(&task.ancestors_, 0, callback, loose, nullptr, 0);
+                }
+            });
+    }
+
+    std::vector<Rect<float>> GetAreas()
+    {
+        std::vector<Rect<float>> areas;
+        root_->GetAreas(&areas);
+        return areas;
+    }
+
+    // Items in storage order, which removals shuffle.
+    std::span<const QuadTreeItem> GetItems() const
+    {
+        return items_;
+    }
+
+    // Writes the tree in the layout of QuadTreeSnapshot.hpp, to be opened with MappedQuadTree or Load.
+    // T must be trivially copyable.
+    bool Save(const std::string& path) const
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable items can be saved");
+
+        std::vector<snapshot::Node> nodes;
+        std::vector<snapshot::Item<T>> items;
+        items.reserve(items_.size());
+        root_->Flatten(&nodes, &items);
+
+        snapshot::Header header = {};
+        std::memcpy(header.magic_, snapshot::magic, sizeof(snapshot::magic));
+        header.version_ = snapshot::version;
+        header.item_size_ = sizeof(T);
+        header.node_count_ = nodes.size();
+        header.item_count_ = items.size();
+        header.area_ = root_->area_;
+        header.max_depth_ = static_cast<std::uint32_t>(config_.max_depth_);
+        header.node_capacity_ = static_cast<std::uint32_t>(config_.node_capacity_);
+        header.merge_threshold_ = static_cast<std::uint32_t>(config_.merge_threshold_);
+        header.looseness_ = config_.looseness_;
+
+        // Written next to the target and renamed over it at the end, so a failed save leaves neither a
+        // truncated snapshot nor a damaged previous one behind.
+        const std::string temp_path = path + ".tmp";
+        std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+
+        if (file == nullptr)
+        {
+            printf("%s%s\n", "Failed to create snapshot ", temp_path.c_str());
+            return false;
+        }
+
+        const char padding[snapshot::section_alignment] = {};
+        const std::size_t nodes_end = snapshot::NodesOffset() + nodes.size() * sizeof(snapshot::Node);
+        bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        written = written && std::fwrite(padding, 1, snapshot::NodesOffset() - sizeof(header), file) == snapshot::NodesOffset() - sizeof(header);
+        written = written && std::fwrite(nodes.data(), sizeof(snapshot::Node), nodes.size(), file) == nodes.size();
+        written = written && std::fwrite(padding, 1, snapshot::ItemsOffset(nodes.size()) - nodes_end, file) == snapshot::ItemsOffset(nodes.size()) - nodes_end;
+        written = written && (items.empty() || std::fwrite(items.data(), sizeof(snapshot::Item<T>), items.size(), file) == items.size());
+        written = std::fclose(file) == 0 && written;
+
+#ifndef QUADTREE_SNAPSHOT_MMAP
+        // rename does not replace an existing file everywhere.
+        written = written && (std::remove(path.c_str()) == 0 || errno == ENOENT);
+#endif
+        written = written && std::rename(temp_path.c_str(), path.c_str()) == 0;
+
+        if (!written)
+        {
+            printf("%s%s\n", "Failed to write snapshot ", path.c_str());
+            std::remove(temp_path.c_str());
+        }
+
+        return written;
+    }
+
+    // Builds a mutable tree with the saved area and config from a snapshot, through InsertBulk. Returns
+    // nullptr if the file cannot be read. For read-only use, MappedQuadTree skips the rebuild.
+    static std::unique_ptr<QuadTree> Load(const std::string& path, ThreadPool* pool = nullptr)
+    {
+        MappedQuadTree<T> mapped;
+
+        if (!mapped.Open(path))
+        {
+            return nullptr;
+        }
+
+        const snapshot::Header& header = mapped.GetHeader();
+        QuadTreeConfig config;
+        config.max_depth_ = header.max_depth_;
+        config.node_capacity_ = header.node_capacity_;
+        config.merge_threshold_ = header.merge_threshold_;
+        config.looseness_ = header.looseness_;
+
+        std::vector<std::pair<T, Rect<float>>> entries;
+        entries.reserve(mapped.Size());
+
+        for (const snapshot::Item<T>& item : mapped.GetItems())
+        {
+            entries.emplace_back(item.item_, Rect<float>(item.bbox_));
+        }
+
+        return std::make_unique<QuadTree>(Rect<float>(header.area_), config, entries, pool);
+    }
+
+    // Walks the whole tree, so meant for diagnostics rather than every frame.
+    quadtree_stats::TreeStats GetStats() const
+    {
+        quadtree_stats::TreeStats stats;
+        root_->CollectStats(&stats);
+        stats.item_count_ = items_.size();
+        stats.root_items_ = root_->item_indices_.size();
+        stats.bytes_used_ += items_.capacity() * sizeof(QuadTreeItem) + handles_.capacity() * sizeof(HandleSlot);
+        return stats;
     }
 };
 
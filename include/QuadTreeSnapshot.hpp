@@ -0,0 +1,370 @@
+#ifndef QUAD_TREE_SNAPSHOT_HPP
+#define QUAD_TREE_SNAPSHOT_HPP
+
+#include "geometry/AABB.hpp"
+
+#include <string>
+#include <span>
+#include <new>
+#include <limits>
+#include <type_traits>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define QUADTREE_SNAPSHOT_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// On-disk layout written by QuadTree::Save: a header, the nodes in depth-first pre-order, then the
+// items grouped by node in the same order. Links are array indices, so the file is used as is after
+// mapping it. Since a node's descendants follow it, the items of a whole subtree are one contiguous
+// run starting at the node's first item. Numbers are stored in the byte order of the machine that
+// saved the file; a file from the other byte order fails the version check.
+namespace snapshot
+{
+    inline constexpr char magic[8] = { 'Q', 'T', 'S', 'N', 'A', 'P', '\0', '\0' };
+    inline constexpr std::uint32_t version = 1;
+    inline constexpr std::uint32_t no_child = std::numeric_limits<std::uint32_t>::max();
+    inline constexpr std::size_t section_alignment = 64;
+
+    struct Header
+    {
+        char magic_[8];
+        std::uint32_t version_;
+        std::uint32_t item_size_;
+        std::uint64_t node_count_;
+        std::uint64_t item_count_;
+        AABB<float> area_;
+        std::uint32_t max_depth_;
+        std::uint32_t node_capacity_;
+        std::uint32_t merge_threshold_;
+        float looseness_;
+    };
+
+    struct Node
+    {
+        AABB<float> bounds_;
+        std::uint32_t children_[4];
+        std::uint32_t first_item_;
+        std::uint32_t item_count_;
+        std::uint32_t subtree_count_;
+        std::uint32_t depth_;
+    };
+
+    template <typename T>
+    struct Item
+    {
+        AABB<float> bbox_;
+        T item_;
+    };
+
+    static_assert(sizeof(Header) == 64 && sizeof(Node) == 48);
+
+    inline std::size_t NodesOffset()
+    {
+        return section_alignment;
+    }
+
+    inline std::size_t ItemsOffset(std::size_t node_count)
+    {
+        return (NodesOffset() + node_count * sizeof(Node) + section_alignment - 1) / section_alignment * section_alignment;
+    }
+} // namespace snapshot
+
+// Read-only tree over a file written by QuadTree::Save. The file is mapped rather than read, so
+// opening costs the same for any size, pages are loaded as queries touch them and processes mapping
+// the same file share one copy in the page cache.
+template <typename T>
+class MappedQuadTree
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    typedef snapshot::Item<T> Item;
+
+private:
+    const char* data_;
+    std::size_t size_;
+    const snapshot::Header* header_;
+    const snapshot::Node* nodes_;
+    const Item* items_;
+
+    template <typename Visitor>
+    static bool Visit(Visitor& visitor, const Item& item)
+    {
+        if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, const Item&>>)
+        {
+            visitor(item);
+            return true;
+        }
+        else
+        {
+            return static_cast<bool>(visitor(item));
+        }
+    }
+
+    template <typename AreaType, typename Visitor>
+    bool Search(std::uint32_t node_index, const AreaType& area_to_search, Visitor& visitor) const
+    {
+        const snapshot::Node& node = nodes_[node_index];
+
+        for (std::uint32_t i = node.first_item_; i < node.first_item_ + node.item_count_; ++i)
+        {
+            if (area_to_search.Intersects(items_[i].bbox_) && !Visit(visitor, items_[i]))
+            {
+                return false;
+            }
+        }
+
+        for (std::uint32_t child_index : node.children_)
+        {
+            if (child_index == snapshot::no_child)
+            {
+                continue;
+            }
+
+            const snapshot::Node& child = nodes_[child_index];
+
+            if (area_to_search.Contains(child.bounds_))
+            {
+                for (std::uint32_t i = child.first_item_; i < child.first_item_ + child.subtree_count_; ++i)
+                {
+                    if (!Visit(visitor, items_[i]))
+                    {
+                        return false;
+                    }
+                }
+            }
+            else if (area_to_search.Intersects(child.bounds_) && !Search(child_index, area_to_search, visitor))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    template <typename AreaType>
+    std::size_t Count(std::uint32_t node_index, const AreaType& area_to_search) const
+    {
+        const snapshot::Node& node = nodes_[node_index];
+        std::size_t count = 0;
+
+        for (std::uint32_t i = node.first_item_; i < node.first_item_ + node.item_count_; ++i)
+        {
+            if (area_to_search.Intersects(items_[i].bbox_))
+            {
+                ++count;
+            }
+        }
+
+        for (std::uint32_t child_index : node.children_)
+        {
+            if (child_index == snapshot::no_child)
+            {
+                continue;
+            }
+
+            const snapshot::Node& child = nodes_[child_index];
+
+            if (area_to_search.Contains(child.bounds_))
+            {
+                count += child.subtree_count_;
+            }
+            else if (area_to_search.Intersects(child.bounds_))
+            {
+                count += Count(child_index, area_to_search);
+            }
+        }
+
+        return count;
+    }
+
+    // The layout is trusted only after this, so a truncated or foreign file cannot send a query out of
+    // bounds. Children must come after their parent, which also rules out cycles.
+    bool Validate() const
+    {
+        if (size_ < sizeof(snapshot::Header))
+        {
+            return false;
+        }
+
+        if (std::memcmp(header_->magic_, snapshot::magic, sizeof(snapshot::magic)) != 0 || header_->version_ != snapshot::version ||
+        header_->item_size_ != sizeof(T) || header_->node_count_ == 0 || header_->node_count_ >= snapshot::no_child ||
+        header_->item_count_ >= snapshot::no_child)
+        {
+            return false;
+        }
+
+        if (size_ < snapshot::ItemsOffset(header_->node_count_) + header_->item_count_ * sizeof(Item))
+        {
+            return false;
+        }
+
+        for (std::uint64_t i = 0; i < header_->node_count_; ++i)
+        {
+            const snapshot::Node& node = nodes_[i];
+
+            if (node.item_count_ > node.subtree_count_ || std::uint64_t(node.first_item_) + node.subtree_count_ > header_->item_count_)
+            {
+                return false;
+            }
+
+            for (std::uint32_t child_index : node.children_)
+            {
+                if (child_index != snapshot::no_child && (child_index <= i || child_index >= header_->node_count_))
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    void Release()
+    {
+        if (data_ == nullptr)
+        {
+            return;
+        }
+
+#ifdef QUADTREE_SNAPSHOT_MMAP
+        munmap(const_cast<char*>(data_), size_);
+#else
+        ::operator delete(const_cast<char*>(data_), std::align_val_t(snapshot::section_alignment));
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+public:
+    MappedQuadTree() : data_(nullptr), size_(0), header_(nullptr), nodes_(nullptr), items_(nullptr)
+    {
+    }
+
+    ~MappedQuadTree()
+    {
+        Release();
+    }
+
+    MappedQuadTree(const MappedQuadTree&) = delete;
+    MappedQuadTree& operator=(const MappedQuadTree&) = delete;
+
+    bool Open(const std::string& path)
+    {
+        Release();
+
+#ifdef QUADTREE_SNAPSHOT_MMAP
+        const int fd = open(path.c_str(), O_RDONLY);
+        struct stat file_stat;
+
+        if (fd < 0 || fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+        {
+            printf("%s%s\n", "Failed to open snapshot ", path.c_str());
+
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+
+            return false;
+        }
+
+        size_ = static_cast<std::size_t>(file_stat.st_size);
+        void* mapping = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (mapping == MAP_FAILED)
+        {
+            printf("%s%s\n", "Failed to map snapshot ", path.c_str());
+            size_ = 0;
+            return false;
+        }
+
+        data_ = static_cast<const char*>(mapping);
+#else
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+
+        if (file == nullptr || std::fseek(file, 0, SEEK_END) != 0 || std::ftell(file) <= 0)
+        {
+            printf("%s%s\n", "Failed to open snapshot ", path.c_str());
+
+            if (file != nullptr)
+            {
+                std::fclose(file);
+            }
+
+            return false;
+        }
+
+        size_ = static_cast<std::size_t>(std::ftell(file));
+        char* buffer = static_cast<char*>(::operator new(size_, std::align_val_t(snapshot::section_alignment)));
+        std::rewind(file);
+        const bool read = std::fread(buffer, 1, size_, file) == size_;
+        std::fclose(file);
+        data_ = buffer;
+
+        if (!read)
+        {
+            printf("%s%s\n", "Failed to read snapshot ", path.c_str());
+            Release();
+            return false;
+        }
+#endif
+
+        header_ = reinterpret_cast<const snapshot::Header*>(data_);
+        nodes_ = reinterpret_cast<const snapshot::Node*>(data_ + snapshot::NodesOffset());
+        items_ = size_ >= sizeof(snapshot::Header) ? reinterpret_cast<const Item*>(data_ + snapshot::ItemsOffset(header_->node_count_)) : nullptr;
+
+        if (!Validate())
+        {
+            printf("%s%s%s\n", "Snapshot ", path.c_str(), " is corrupt or holds a different item type!");
+            Release();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool IsOpen() const
+    {
+        return data_ != nullptr;
+    }
+
+    const snapshot::Header& GetHeader() const
+    {
+        return *header_;
+    }
+
+    std::size_t Size() const
+    {
+        return IsOpen() ? header_->item_count_ : 0;
+    }
+
+    std::span<const Item> GetItems() const
+    {
+        return IsOpen() ? std::span<const Item>(items_, header_->item_count_) : std::span<const Item>();
+    }
+
+    // Same contract as QuadTree::Query; the visitor receives the stored Item.
+    template <typename AreaType, typename Visitor>
+    bool Query(const AreaType& area_to_search, Visitor visitor) const
+    {
+        return !IsOpen() || Search(0, area_to_search, visitor);
+    }
+
+    template <typename AreaType>
+    std::size_t Count(const AreaType& area_to_search) const
+    {
+        return IsOpen() ? Count(0, area_to_search) : 0;
+    }
+};
+
+#endif
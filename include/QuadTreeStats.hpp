@@ -0,0 +1,97 @@
+#ifndef QUAD_TREE_STATS_HPP
+#define QUAD_TREE_STATS_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Query counters are compiled in only with QUADTREE_STATS defined (make STATS=1); otherwise the hooks
+// in the traversal expand to nothing. Each thread counts its own queries, so read and reset them on
+// the thread that ran the queries (for SearchBatch, the pool's workers count their share).
+namespace quadtree_stats
+{
+    struct QueryCounters
+    {
+        std::uint64_t nodes_visited_ = 0;
+        std::uint64_t items_tested_ = 0;
+        std::uint64_t items_returned_ = 0;
+        // Subtrees covered by the query area, whose items were added without testing them.
+        std::uint64_t subtree_adds_ = 0;
+    };
+
+#ifdef QUADTREE_STATS
+    inline thread_local QueryCounters query_counters;
+
+    #define QUADTREE_COUNT(counter, amount) (quadtree_stats::query_counters.counter += (amount))
+#else
+    #define QUADTREE_COUNT(counter, amount) ((void)0)
+#endif
+
+    inline QueryCounters GetQueryCounters()
+    {
+#ifdef QUADTREE_STATS
+        return query_counters;
+#else
+        return QueryCounters();
+#endif
+    }
+
+    inline void ResetQueryCounters()
+    {
+#ifdef QUADTREE_STATS
+        query_counters = QueryCounters();
+#endif
+    }
+
+    // Shape of a tree, gathered on demand by QuadTree::GetStats().
+    struct TreeStats
+    {
+        // Allocated nodes, the root included.
+        std::size_t node_count_ = 0;
+        std::size_t item_count_ = 0;
+        // Items stored in the root itself; every query tests them.
+        std::size_t root_items_ = 0;
+        // Items stored in split nodes below the root because no child holds them, e.g. boxes across a
+        // midline of a tight tree. Disjoint from root_items_; leaves never count.
+        std::size_t straddling_items_ = 0;
+        // Nodes, item storage and per-node slots, excluding allocator overhead.
+        std::size_t bytes_used_ = 0;
+        // Node and stored item counts indexed by depth, the root at 0.
+        std::vector<std::size_t> nodes_per_depth_;
+        std::vector<std::size_t> items_per_depth_;
+    };
+
+    inline std::string ToJson(const std::vector<std::size_t>& values)
+    {
+        std::string json = "[";
+
+        for (std::size_t i = 0; i < values.size(); ++i)
+        {
+            json += (i == 0 ? "" : ",") + std::to_string(values[i]);
+        }
+
+        return json + "]";
+    }
+
+    inline std::string ToJson(const TreeStats& stats)
+    {
+        return "{\"node_count\":" + std::to_string(stats.node_count_) + 
+        ",\"item_count\":" + std::to_string(stats.item_count_) + 
+        ",\"root_items\":" + std::to_string(stats.root_items_) + 
+        ",\"straddling_items\":" + std::to_string(stats.straddling_items_) + 
+        ",\"bytes_used\":" + std::to_string(stats.bytes_used_) + 
+        ",\"nodes_per_depth\":" + ToJson(stats.nodes_per_depth_) + 
+        ",\"items_per_depth\":" + ToJson(stats.items_per_depth_) + "}";
+    }
+
+    inline std::string ToJson(const QueryCounters& counters)
+    {
+        return "{\"nodes_visited\":" + std::to_string(counters.nodes_visited_) + 
+        ",\"items_tested\":" + std::to_string(counters.items_tested_) + 
+        ",\"items_returned\":" + std::to_string(counters.items_returned_) + 
+        ",\"subtree_adds\":" + std::to_string(counters.subtree_adds_) + "}";
+    }
+} // namespace quadtree_stats
+
+#endif
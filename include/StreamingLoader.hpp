@@ -0,0 +1,357 @@
+#ifndef STREAMING_LOADER_HPP
+#define STREAMING_LOADER_HPP
+
+#include "QuadTree.hpp"
+#include "QuadTreeSnapshot.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+
+enum class RecordFormat { CSV, BINARY };
+
+struct StreamingLoaderConfig
+{
+    // Bytes read from the file at a time.
+    std::size_t chunk_bytes_ = 1 << 20;
+    // Items handed to QuadTree::InsertBulk at a time.
+    std::size_t batch_items_ = 1 << 16;
+    // Parsed batches waiting for the tree; the reader blocks once this many are queued.
+    std::size_t max_batches_ = 4;
+};
+
+struct LoadProgress
+{
+    std::size_t bytes_read_;
+    std::size_t total_bytes_;
+    std::size_t items_loaded_;
+    // Lines that failed to parse, e.g. a CSV header, and a truncated trailing binary record.
+    std::size_t bad_records_;
+};
+
+// Loads items from a file into a tree as a pipeline: a background thread reads and parses the file
+// chunk by chunk while the calling thread inserts the previous batches, so I/O and parsing overlap
+// with building the tree. Only a few chunks and batches are alive at once, so memory beyond the
+// tree itself stays flat whatever the file size.
+//
+// CSV lines are parsed by the parser given to SetCsvParser; for arithmetic T the default expects
+// "x,y,width,height,value". Binary files are a plain sequence of snapshot::Item<T> records (box, then
+// item), the layout of the items section of a snapshot.
+template <typename T>
+class StreamingLoader
+{
+public:
+    typedef std::vector<std::pair<T, Rect<float>>> Batch;
+    // Parses one null-terminated line without its newline; returns false to skip it.
+    typedef std::function<bool(const char* line, T* item, Rect<float>* item_bbox)> CsvParser;
+    typedef std::function<void(const LoadProgress& progress)> ProgressCallback;
+
+private:
+    struct Pipeline
+    {
+        std::mutex mutex_;
+        std::condition_variable ready_;
+        std::condition_variable space_;
+        std::deque<Batch> full_;
+        std::vector<Batch> free_;
+        bool done_ = false;
+        bool failed_ = false;
+        std::atomic<std::size_t> bytes_read_ = 0;
+        std::atomic<std::size_t> bad_records_ = 0;
+    };
+
+    StreamingLoaderConfig config_;
+    CsvParser csv_parser_;
+
+    static bool ParseDefault(const char* line, T* item, Rect<float>* item_bbox)
+    {
+        if constexpr (std::is_arithmetic_v<T>)
+        {
+            double fields[5];
+            const char* cursor = line;
+
+            for (std::size_t i = 0; i < 5; ++i)
+            {
+                char* end = nullptr;
+                fields[i] = std::strtod(cursor, &end);
+
+                if (end == cursor)
+                {
+                    return false;
+                }
+
+                cursor = end;
+
+                while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')
+                {
+                    ++cursor;
+                }
+
+                if (i < 4 && *cursor++ != ',')
+                {
+                    return false;
+                }
+            }
+
+            *item_bbox = Rect<float>(static_cast<float>(fields[0]), static_cast<float>(fields[1]), static_cast<float>(fields[2]), static_cast<float>(fields[3]));
+            *item = static_cast<T>(fields[4]);
+            return true;
+        }
+        else
+        {
+            (void) line;
+            (void) item;
+            (void) item_bbox;
+            return false;
+        }
+    }
+
+    Batch TakeFreeBatch(Pipeline* pipeline) const
+    {
+        std::lock_guard<std::mutex> lock(pipeline->mutex_);
+        Batch batch;
+
+        if (!pipeline->free_.empty())
+        {
+            batch = std::move(pipeline->free_.back());
+            pipeline->free_.pop_back();
+        }
+
+        batch.reserve(config_.batch_items_);
+        return batch;
+    }
+
+    void Submit(Pipeline* pipeline, Batch* batch) const
+    {
+        {
+            std::unique_lock<std::mutex> lock(pipeline->mutex_);
+            pipeline->space_.wait(lock, [this, pipeline]() { return pipeline->full_.size() < config_.max_batches_; });
+            pipeline->full_.push_back(std::move(*batch));
+        }
+
+        pipeline->ready_.notify_one();
+        *batch = TakeFreeBatch(pipeline);
+    }
+
+    void Add(Pipeline* pipeline, Batch* batch, const T& item, const Rect<float>& item_bbox) const
+    {
+        batch->emplace_back(item, item_bbox);
+
+        if (batch->size() >= config_.batch_items_)
+        {
+            Submit(pipeline, batch);
+        }
+    }
+
+    // Parses the complete lines of buffer[0, size) and returns how many bytes were consumed.
+    std::size_t ParseCsv(Pipeline* pipeline, Batch* batch, char* buffer, std::size_t size, bool last) const
+    {
+        std::size_t line_begin = 0;
+
+        while (line_begin < size)
+        {
+            char* newline = static_cast<char*>(std::memchr(buffer + line_begin, '\n', size - line_begin));
+
+            if (newline == nullptr && !last)
+            {
+                break;
+            }
+
+            const std::size_t line_end = newline != nullptr ? static_cast<std::size_t>(newline - buffer) : size;
+            buffer[line_end] = '\0';
+
+            T item = T();
+            Rect<float> item_bbox;
+
+            if (line_end > line_begin && csv_parser_(buffer + line_begin, &item, &item_bbox))
+            {
+                Add(pipeline, batch, item, item_bbox);
+            }
+            else if (line_end > line_begin)
+            {
+                pipeline->bad_records_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            line_begin = line_end + 1;
+        }
+
+        return std::min(line_begin, size);
+    }
+
+    std::size_t ParseBinary(Pipeline* pipeline, Batch* batch, const char* buffer, std::size_t size, bool last) const
+    {
+        constexpr std::size_t record_size = sizeof(snapshot::Item<T>);
+        const std::size_t record_count = size / record_size;
+
+        for (std::size_t i = 0; i < record_count; ++i)
+        {
+            snapshot::Item<T> record;
+            std::memcpy(&record, buffer + i * record_size, record_size);
+            Add(pipeline, batch, record.item_, Rect<float>(record.bbox_));
+        }
+
+        if (last && size % record_size != 0)
+        {
+            pipeline->bad_records_.fetch_add(1, std::memory_order_relaxed);
+            return size;
+        }
+
+        return record_count * record_size;
+    }
+
+    // Reader thread: fills a buffer chunk by chunk, keeping the unparsed tail of one chunk (a partial
+    // line or record) at the front of the next.
+    template <RecordFormat format>
+    void Produce(Pipeline* pipeline, std::FILE* file) const
+    {
+        std::vector<char> buffer(config_.chunk_bytes_ + 1);
+        std::size_t carried = 0;
+        Batch batch = TakeFreeBatch(pipeline);
+
+        while (true)
+        {
+            if (buffer.size() < carried + config_.chunk_bytes_ + 1)
+            {
+                // A single line longer than a chunk.
+                buffer.resize(carried + config_.chunk_bytes_ + 1);
+            }
+
+            const std::size_t read = std::fread(buffer.data() + carried, 1, config_.chunk_bytes_, file);
+            const bool last = read < config_.chunk_bytes_;
+            const std::size_t size = carried + read;
+            pipeline->bytes_read_.fetch_add(read, std::memory_order_relaxed);
+
+            std::size_t consumed = 0;
+
+            if constexpr (format == RecordFormat::CSV)
+            {
+                consumed = ParseCsv(pipeline, &batch, buffer.data(), size, last);
+            }
+            else
+            {
+                consumed = ParseBinary(pipeline, &batch, buffer.data(), size, last);
+            }
+
+            carried = size - consumed;
+            std::memmove(buffer.data(), buffer.data() + consumed, carried);
+
+            if (last)
+            {
+                break;
+            }
+        }
+
+        if (!batch.empty())
+        {
+            Submit(pipeline, &batch);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(pipeline->mutex_);
+            pipeline->failed_ = pipeline->failed_ || std::ferror(file) != 0;
+            pipeline->done_ = true;
+        }
+
+        pipeline->ready_.notify_one();
+    }
+
+public:
+    explicit StreamingLoader(const StreamingLoaderConfig& config = StreamingLoaderConfig()) : config_(config), csv_parser_(&StreamingLoader::ParseDefault)
+    {
+        config_.chunk_bytes_ = std::max<std::size_t>(config_.chunk_bytes_, 1);
+        config_.batch_items_ = std::max<std::size_t>(config_.batch_items_, 1);
+        config_.max_batches_ = std::max<std::size_t>(config_.max_batches_, 1);
+    }
+
+    void SetCsvParser(const CsvParser& csv_parser)
+    {
+        csv_parser_ = csv_parser;
+    }
+
+    // Inserts every record of the file into tree, batch by batch through InsertBulk (using pool if
+    // given). progress, if set, is called after each batch. Returns false if the file could not be
+    // read; records loaded before a read error stay in the tree. Binary records are copied as raw
+    // bytes, so they are only accepted for a trivially copyable T.
+    template <RecordFormat format>
+    bool Load(const std::string& path, QuadTree<T>* tree, ThreadPool* pool = nullptr, const ProgressCallback& progress = nullptr)
+    {
+        static_assert(format == RecordFormat::CSV || std::is_trivially_copyable_v<T>, "Binary records need a trivially copyable item type");
+
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+
+        if (file == nullptr)
+        {
+            printf("%s%s\n", "Failed to open ", path.c_str());
+            return false;
+        }
+
+        std::size_t total_bytes = 0;
+
+        if (std::fseek(file, 0, SEEK_END) == 0)
+        {
+            total_bytes = static_cast<std::size_t>(std::max(std::ftell(file), 0L));
+        }
+
+        std::rewind(file);
+
+        Pipeline pipeline;
+        std::thread reader(&StreamingLoader::Produce<format>, this, &pipeline, file);
+        std::size_t items_loaded = 0;
+
+        while (true)
+        {
+            Batch batch;
+
+            {
+                std::unique_lock<std::mutex> lock(pipeline.mutex_);
+                pipeline.ready_.wait(lock, [&pipeline]() { return !pipeline.full_.empty() || pipeline.done_; });
+
+                if (pipeline.full_.empty())
+                {
+                    break;
+                }
+
+                batch = std::move(pipeline.full_.front());
+                pipeline.full_.pop_front();
+            }
+
+            pipeline.space_.notify_one();
+            tree->InsertBulk(batch, pool);
+            items_loaded += batch.size();
+
+            if (progress)
+            {
+                progress({ pipeline.bytes_read_.load(std::memory_order_relaxed), total_bytes, items_loaded,
+                pipeline.bad_records_.load(std::memory_order_relaxed) });
+            }
+
+            batch.clear();
+            std::lock_guard<std::mutex> lock(pipeline.mutex_);
+            pipeline.free_.push_back(std::move(batch));
+        }
+
+        reader.join();
+        std::fclose(file);
+
+        if (pipeline.failed_)
+        {
+            printf("%s%s\n", "Failed to read ", path.c_str());
+        }
+
+        return !pipeline.failed_;
+    }
+};
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed set of worker threads for fork-join loops over the tree. The calling thread takes part as
+// worker 0, so a pool of size 1 runs everything inline without spawning threads.
+class ThreadPool
+{
+private:
+    // A worker's share of a loop, packed as begin << 32 | end so the owner taking chunks off the front
+    // and thieves taking halves off the back agree through a single compare-and-swap.
+    struct alignas(64) WorkRange
+    {
+        std::atomic<std::uint64_t> range_;
+    };
+
+    static std::uint64_t Pack(std::uint64_t begin, std::uint64_t end)
+    {
+        return (begin << 32) | end;
+    }
+
+    static bool TakeFront(WorkRange& work, std::size_t grain, std::size_t* begin, std::size_t* end)
+    {
+        std::uint64_t range = work.range_.load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            const std::uint64_t range_begin = range >> 32;
+            const std::uint64_t range_end = range & 0xffffffff;
+
+            if (range_begin >= range_end)
+            {
+                return false;
+            }
+
+            const std::uint64_t chunk_end = std::min<std::uint64_t>(range_begin + grain, range_end);
+
+            if (work.range_.compare_exchange_weak(range, Pack(chunk_end, range_end), std::memory_order_acq_rel))
+            {
+                *begin = range_begin;
+                *end = chunk_end;
+                return true;
+            }
+        }
+    }
+
+    static bool StealBack(WorkRange& victim, std::size_t* begin, std::size_t* end)
+    {
+        std::uint64_t range = victim.range_.load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            const std::uint64_t range_begin = range >> 32;
+            const std::uint64_t range_end = range & 0xffffffff;
+
+            if (range_begin >= range_end)
+            {
+                return false;
+            }
+
+            const std::uint64_t steal_begin = range_end - std::max<std::uint64_t>((range_end - range_begin) / 2, 1);
+
+            if (victim.range_.compare_exchange_weak(range, Pack(range_begin, steal_begin), std::memory_order_acq_rel))
+            {
+                *begin = steal_begin;
+                *end = range_end;
+                return true;
+            }
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::function<void(std::size_t)> job_;
+    std::size_t generation_;
+    std::size_t active_;
+    bool stopping_;
+
+    void WorkerLoop(std::size_t worker)
+    {
+        std::size_t seen_generation = 0;
+
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this, seen_generation]() { return stopping_ || generation_ != seen_generation; });
+
+            if (stopping_)
+            {
+                return;
+            }
+
+            seen_generation = generation_;
+            lock.unlock();
+
+            job_(worker);
+
+            lock.lock();
+
+            if (--active_ == 0)
+            {
+                done_.notify_one();
+            }
+        }
+    }
+
+    void Run(const std::function<void(std::size_t)>& job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = job;
+            active_ = workers_.size();
+            ++generation_;
+        }
+
+        wake_.notify_all();
+        job(0);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return active_ == 0; });
+    }
+
+public:
+    explicit ThreadPool(std::size_t thread_count = std::thread::hardware_concurrency()) : generation_(0), active_(0), stopping_(false)
+    {
+        for (std::size_t worker = 1; worker < std::max<std::size_t>(thread_count, 1); ++worker)
+        {
+            workers_.emplace_back(&ThreadPool::WorkerLoop, this, worker);
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+
+        wake_.notify_all();
+
+        for (std::thread& worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::size_t Size() const
+    {
+        return workers_.size() + 1;
+    }
+
+    // Calls fn(begin, end, worker) over [0, count) in chunks of at most grain indices. Every worker starts
+    // on an equal contiguous share; one that runs dry steals the back half of the next non-empty
+    // share, so uneven chunks balance out without a shared counter. Returns when all calls have
+    // finished. count must fit in 32 bits.
+    template <typename Fn>
+    void ParallelForRange(std::size_t count, std::size_t grain, Fn&& fn)
+    {
+        const std::size_t worker_count = Size();
+        std::unique_ptr<WorkRange[]> ranges(new WorkRange[worker_count]);
+
+        for (std::size_t worker = 0; worker < worker_count; ++worker)
+        {
+            ranges[worker].range_.store(Pack(count * worker / worker_count, count * (worker + 1) / worker_count), std::memory_order_relaxed);
+        }
+
+        grain = std::max<std::size_t>(grain, 1);
+
+        Run([&ranges, worker_count, grain, &fn](std::size_t worker)
+            {
+                std::size_t begin = 0;
+                std::size_t end = 0;
+
+                while (true)
+                {
+                    while (TakeFront(ranges[worker], grain, &begin, &end))
+                    {
+                        fn(begin, end, worker);
+                    }
+
+                    bool stolen = false;
+
+                    for (std::size_t offset = 1; offset < worker_count && !stolen; ++offset)
+                    {
+                        stolen = StealBack(ranges[(worker + offset) % worker_count], &begin, &end);
+                    }
+
+                    if (!stolen)
+                    {
+                        return;
+                    }
+
+                    ranges[worker].range_.store(Pack(begin, end), std::memory_order_release);
+                }
+            });
+    }
+
+    // Calls fn(index, worker) for every index in [0, count), one index per chunk.
+    template <typename Fn>
+    void ParallelFor(std::size_t count, Fn&& fn)
+    {
+        ParallelForRange(count, 1, [&fn](std::size_t begin, std::size_t end, std::size_t worker)
+            {
+                for (std::size_t index = begin; index < end; ++index)
+                {
+                    fn(index, worker);
+                }
+            });
+    }
+};
+
+#endif
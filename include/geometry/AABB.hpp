@@ -0,0 +1,97 @@
+#ifndef AABB_HPP
+#define AABB_HPP
+
+#include <type_traits>
+#include <algorithm>
+#include <utility>
+
+// Plain min/max box used for the tree's internal storage. Unlike Rect it has no vtable, so it stays
+// trivially copyable and packs densely into arrays. Edge semantics match Rect: Contains excludes the
+// max edges, Intersects includes the other box's min edges.
+template <typename T>
+struct AABB
+{
+    static_assert(std::is_arithmetic_v<T>);
+
+    T min_x_;
+    T min_y_;
+    T max_x_;
+    T max_y_;
+
+    T GetWidth() const
+    {
+        return max_x_ - min_x_;
+    }
+
+    T GetHeight() const
+    {
+        return max_y_ - min_y_;
+    }
+
+    AABB<T> Inflate(T dx, T dy) const
+    {
+        return { min_x_ - dx, min_y_ - dy, max_x_ + dx, max_y_ + dy };
+    }
+
+    // Squared distance from (x, y) to the closest point of the box, 0 when inside.
+    T DistanceSquared(T x, T y) const
+    {
+        const T dx = x < min_x_ ? min_x_ - x : (x > max_x_ ? x - max_x_ : 0);
+        const T dy = y < min_y_ ? min_y_ - y : (y > max_y_ ? y - max_y_ : 0);
+        return dx * dx + dy * dy;
+    }
+
+    // Clips the parameter range of origin + t * direction against the box (edges included). On a hit,
+    // t_enter receives the first t inside the box within [t_min, t_max].
+    bool IntersectRay(T origin_x, T origin_y, T direction_x, T direction_y, T t_min, T t_max, T* t_enter) const
+    {
+        if (!ClipSlab(origin_x, direction_x, min_x_, max_x_, &t_min, &t_max) || !ClipSlab(origin_y, direction_y, min_y_, max_y_, &t_min, &t_max))
+        {
+            return false;
+        }
+
+        *t_enter = t_min;
+        return true;
+    }
+
+    bool Contains(const AABB<T>& other) const
+    {
+        return other.min_x_ >= min_x_ && other.min_y_ >= min_y_ && other.max_x_ < max_x_ && other.max_y_ < max_y_;
+    }
+
+    bool Intersects(const AABB<T>& other) const
+    {
+        return min_x_ < other.max_x_ && max_x_ >= other.min_x_ && min_y_ < other.max_y_ && max_y_ >= other.min_y_;
+    }
+
+    // Symmetric overlap test with edges included, used for item-vs-item checks.
+    bool Overlaps(const AABB<T>& other) const
+    {
+        return min_x_ <= other.max_x_ && other.min_x_ <= max_x_ && min_y_ <= other.max_y_ && other.min_y_ <= max_y_;
+    }
+
+private:
+    static bool ClipSlab(T origin, T direction, T low, T high, T* t_min, T* t_max)
+    {
+        if (direction == 0)
+        {
+            return origin >= low && origin <= high;
+        }
+
+        T t_low = (low - origin) / direction;
+        T t_high = (high - origin) / direction;
+
+        if (t_low > t_high)
+        {
+            std::swap(t_low, t_high);
+        }
+
+        *t_min = std::max(*t_min, t_low);
+        *t_max = std::min(*t_max, t_high);
+        return *t_min <= *t_max;
+    }
+};
+
+static_assert(std::is_trivially_copyable_v<AABB<float>>);
+
+#endif
@@ -3,7 +3,6 @@
 
 #include "Point.hpp"
 #include "Rect.hpp"
-#include "CircleTexture.hpp"
 
 #include <iostream>
 #include <iomanip>
@@ -13,7 +12,7 @@
 #include <memory>
 
 template <typename T>
-class Circle : public Shape<T>
+class Circle final : public Shape<T>
 {
     static_assert(std::is_arithmetic_v<T>);
 
@@ -44,6 +43,21 @@ public:
         return center_.GetDistance({ clamped_x, clamped_y }) <= radius_;
     }
 
+    bool Contains(const AABB<T>& box) const override
+    {
+        return Contains(Point<T>(box.min_x_, box.min_y_)) && Contains(Point<T>(box.max_x_, box.min_y_)) && 
+            Contains(Point<T>(box.min_x_, box.max_y_)) && Contains(Point<T>(box.max_x_, box.max_y_));
+    }
+
+    // Compares squared distances so the result matches the SIMD leaf scan kernels bit for bit.
+    bool Intersects(const AABB<T>& box) const override
+    {
+        const T dx = center_.x_ - std::clamp(center_.x_, box.min_x_, box.max_x_);
+        const T dy = center_.y_ - std::clamp(center_.y_, box.min_y_, box.max_y_);
+
+        return dx * dx + dy * dy <= radius_ * radius_;
+    }
+
     void MoveTo(const Point<T>& point_destination) override
     {
         center_.x_ = point_destination.x_;
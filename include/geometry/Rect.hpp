@@ -1,6 +1,8 @@
 #ifndef RECT_HPP
 #define RECT_HPP
 
+#include "AABB.hpp"
+
 #include <iostream>
 #include <type_traits>
 #include <iomanip>
@@ -10,7 +12,7 @@ template <typename T>
 class Point;
 
 template <typename T>
-class Rect : public Shape<T>
+class Rect final : public Shape<T>
 {
     static_assert(std::is_arithmetic_v<T>);
 
@@ -26,6 +28,15 @@ public:
         top_left_.y_ = y;
     }
 
+    explicit Rect(const AABB<T>& box) noexcept : Rect(box.min_x_, box.min_y_, box.GetWidth(), box.GetHeight())
+    {
+    }
+
+    AABB<T> GetBounds() const
+    {
+        return { top_left_.x_, top_left_.y_, top_left_.x_ + width_, top_left_.y_ + height_ };
+    }
+
     Point<T> GetTopLeft() const
     {
         return top_left_;
@@ -63,6 +74,16 @@ public:
             top_left_.y_ < rect.top_left_.y_ + rect.height_ && top_left_.y_ + height_ >= rect.top_left_.y_;
     }
 
+    bool Contains(const AABB<T>& box) const override
+    {
+        return GetBounds().Contains(box);
+    }
+
+    bool Intersects(const AABB<T>& box) const override
+    {
+        return GetBounds().Intersects(box);
+    }
+
     void MoveTo(const Point<T>& point_destination) override
     {
         top_left_.x_ = point_destination.x_ - (width_ / 2.0);
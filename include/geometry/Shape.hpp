@@ -7,6 +7,9 @@ class Point;
 template <typename T>
 class Rect;
 
+template <typename T>
+struct AABB;
+
 enum class ShapeType { RECT, CIRCLE };
 
 template <typename T>
@@ -19,6 +22,8 @@ public:
     virtual bool Contains(const Point<T>& point) const = 0;
     virtual bool Contains(const Rect<T>& rect) const = 0;
     virtual bool Intersects(const Rect<T>& rect) const = 0;
+    virtual bool Contains(const AABB<T>& box) const = 0;
+    virtual bool Intersects(const AABB<T>& box) const = 0;
     virtual void MoveTo(const Point<T>& point_destination) = 0;
 };
 
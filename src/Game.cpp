@@ -22,7 +22,8 @@ Game::Game() :
 	rect_side_(80), 
 	searching_(false),
 	removing_(false), 
-	circle_texture_(nullptr)
+	circle_texture_(nullptr), 
+	print_frame_stats_(false)
 {
 	initialized_ = Initialize();
 
@@ -118,29 +119,44 @@ void Game::Run()
 
 	while (running_)
 	{
+		const FrameProfiler::Scope frame_scope(&profiler_, "Frame");
 		const std::uint64_t now = SDL_GetPerformanceCounter();
 		const long double elapsed = static_cast<long double>(now - last_time) / static_cast<long double>(SDL_GetPerformanceFrequency());
 
 		last_time = now;
 		delta += elapsed;
 
-		HandleEvents();
+		{
+			const FrameProfiler::Scope scope(&profiler_, "HandleEvents");
+			HandleEvents();
+		}
 
 		while (delta >= ms)
 		{
+			const FrameProfiler::Scope scope(&profiler_, "Tick");
 			Tick();
 			delta -= ms;
 			++ticks;
 		}
 
 		//printf("%Lf\n", delta / ms);
-		Render();
+		{
+			const FrameProfiler::Scope scope(&profiler_, "Render");
+			Render();
+		}
+
 		++frames;
 
 		if (SDL_GetTicks() - timer > 1000.0)
 		{
 			timer += 1000.0;
-			// printf("Frames: %d, Ticks: %d\n", frames, ticks);
+
+			if (print_frame_stats_)
+			{
+				printf("Frames: %d, Ticks: %d, Items: %zu\n", frames, ticks, qt_->Size());
+			}
+
+			profiler_.Report(print_frame_stats_);
 			frames = 0;
 			ticks = 0;
 		}
@@ -180,6 +196,7 @@ void Game::HandleEvents()
 			QtItemType p = { px - (pw / 2), py - (ph / 2), pw, ph };
 			Rect<float> p_area = { px - (pw / 2), py - (ph / 2), pw, ph };
 
+			const FrameProfiler::Scope scope(&profiler_, "Insert");
 			qt_->Insert(p, p_area);
 		}
 
@@ -219,8 +236,26 @@ void Game::HandleEvents()
 
 			if (e.key.keysym.sym == SDLK_x)
 			{
+				const FrameProfiler::Scope scope(&profiler_, "Reset");
 				qt_->Reset();
 			}
+
+			if (e.key.keysym.sym == SDLK_p)
+			{
+				print_frame_stats_ = !print_frame_stats_;
+			}
+
+			if (e.key.keysym.sym == SDLK_t)
+			{
+				if (profiler_.Tracing())
+				{
+					profiler_.StopTrace();
+				}
+				else
+				{
+					profiler_.StartTrace("quadtree_trace.json");
+				}
+			}
 		}
 		else if (e.type == SDL_KEYUP)
 		{
@@ -262,18 +297,20 @@ void Game::Tick()
 
 		if (searching_ || removing_)
 		{
-			found_items_ = qt_->Search(shape_area_);
+			found_items_.clear();
+
+			{
+				const FrameProfiler::Scope scope(&profiler_, "Search");
+				qt_->Search(*shape_area_, &found_items_);
+			}
 
 			if (removing_)
 			{
-				for (auto& qt_item_it : found_items_)
+				const FrameProfiler::Scope scope(&profiler_, "Remove");
+
+				for (const auto& handle : found_items_)
 				{
-					qt_->Remove(qt_item_it);
-					
-					if (qt_item_it->node_->qt_items_its_.empty())
-					{
-						qt_->CleanUp();
-					}
+					qt_->Remove(handle);
 				}
 			}
 		}
@@ -288,6 +325,8 @@ void Game::Render()
 
 	if (debug_areas_)
 	{
+		const FrameProfiler::Scope scope(&profiler_, "DrawAreas");
+
 		for (const auto& area : qt_->GetAreas())
 		{
 			SDL_SetRenderDrawColor(renderer_, 0xff, 0x00, 0x00, 0xff);
@@ -296,12 +335,16 @@ void Game::Render()
 		}
 	}
 
-	for (const auto& qt_item : qt_->GetItems())
 	{
-		SDL_SetRenderDrawColor(renderer_, 0x00, 0x00, 0x00, 0xff);
-		SDL_FRect r = { qt_item.item_.top_left_.x_, qt_item.item_.top_left_.y_, qt_item.item_.width_, qt_item.item_.height_ };
-		SDL_RenderFillRectF(renderer_, &r);
-		//SDL_RenderDrawPoint(renderer_, qt_item.item_.x_, qt_item.item_.y_);
+		const FrameProfiler::Scope scope(&profiler_, "DrawItems");
+
+		for (const auto& qt_item : qt_->GetItems())
+		{
+			SDL_SetRenderDrawColor(renderer_, 0x00, 0x00, 0x00, 0xff);
+			SDL_FRect r = { qt_item.item_.top_left_.x_, qt_item.item_.top_left_.y_, qt_item.item_.width_, qt_item.item_.height_ };
+			SDL_RenderFillRectF(renderer_, &r);
+			//SDL_RenderDrawPoint(renderer_, qt_item.item_.x_, qt_item.item_.y_);
+		}
 	}
 
 	if (searching_ || removing_)
@@ -310,12 +353,19 @@ void Game::Render()
 
 		if (searching_)
 		{
-			for (const auto& qt_item_it : found_items_)
+			for (const auto& handle : found_items_)
 			{
+				const auto* qt_item = qt_->Get(handle);
+
+				if (qt_item == nullptr)
+				{
+					continue;
+				}
+
 				SDL_SetRenderDrawColor(renderer_, 0x00, 0xff, 0x00, 0xff);
-				SDL_FRect r = { qt_item_it->item_.top_left_.x_, qt_item_it->item_.top_left_.y_, qt_item_it->item_.width_, qt_item_it->item_.height_ };
+				SDL_FRect r = { qt_item->item_.top_left_.x_, qt_item->item_.top_left_.y_, qt_item->item_.width_, qt_item->item_.height_ };
 				SDL_RenderFillRectF(renderer_, &r);
-				// SDL_RenderDrawPoint(renderer_, qt_item_it->item_.x_, qt_item_it->item_.y_);
+				// SDL_RenderDrawPoint(renderer_, qt_item->item_.x_, qt_item->item_.y_);
 			}
 		}
 
@@ -331,5 +381,6 @@ void Game::Render()
 		}
 	}
 
+	const FrameProfiler::Scope scope(&profiler_, "Present");
 	SDL_RenderPresent(renderer_);
 }
@@ -0,0 +1,1628 @@
+#include "QuadTree.hpp"
+#include "ConcurrentQuadTree.hpp"
+#include "CommandQueue.hpp"
+#include "FrameProfiler.hpp"
+#include "StreamingLoader.hpp"
+
+#include <memory_resource>
+#include <memory>
+#include <random>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <algorithm>
+#include <ranges>
+#include <optional>
+#include <limits>
+#include <cmath>
+#include <type_traits>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+
+// Regression tests for QuadTree, headless like the bench. Usage: make test
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			++failures; \
+		} \
+	} while (false)
+
+typedef QuadTree<int>::ItemHandle ItemHandle;
+typedef std::vector<std::pair<int, Rect<float>>> Items;
+
+static const Rect<float> world(0.0f, 0.0f, 1024.0f, 1024.0f);
+
+// Default resource counting the bytes it has handed out and not taken back. Trees built while it is
+// installed allocate everything through it, their pools included.
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+	std::atomic<std::size_t> live_bytes_ = 0;
+
+private:
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		live_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override
+	{
+		live_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+		std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+static std::size_t NodeCount(const QuadTree<int>& qt)
+{
+	return qt.GetStats().node_count_;
+}
+
+// Small boxes with top-left corners inside the world, values numbering them from first.
+static Items RandomItems(std::size_t count, std::mt19937& rng, int first = 0)
+{
+	std::uniform_real_distribution<float> position(0.0f, world.width_);
+	std::uniform_real_distribution<float> side(1.0f, 24.0f);
+	Items items;
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		items.emplace_back(first + static_cast<int>(i), Rect<float>(position(rng), position(rng), side(rng), side(rng)));
+	}
+
+	return items;
+}
+
+static Rect<float> RandomQuery(std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> position(-64.0f, world.width_);
+	std::uniform_real_distribution<float> side(1.0f, 300.0f);
+	return Rect<float>(position(rng), position(rng), side(rng), side(rng));
+}
+
+template <typename AreaType>
+static std::vector<int> TreeValues(const QuadTree<int>& qt, const AreaType& area)
+{
+	std::vector<int> values;
+	qt.Query(area, [&values](const QuadTree<int>::QuadTreeItem& qt_item)
+		{
+			values.push_back(qt_item.item_);
+		});
+	std::sort(values.begin(), values.end());
+	return values;
+}
+
+template <typename AreaType>
+static std::vector<int> BruteForceValues(const Items& items, const AreaType& area)
+{
+	std::vector<int> values;
+
+	for (const auto& [item, item_bbox] : items)
+	{
+		if (area.Intersects(item_bbox.GetBounds()))
+		{
+			values.push_back(item);
+		}
+	}
+
+	std::sort(values.begin(), values.end());
+	return values;
+}
+
+// Random rect queries must find exactly the items a scan of all of them finds, and count as many.
+static void CheckQueries(const QuadTree<int>& qt, const Items& items, std::mt19937& rng)
+{
+	CHECK(qt.Size() == items.size());
+
+	for (int i = 0; i < 50; ++i)
+	{
+		const Rect<float> query = RandomQuery(rng);
+		const std::vector<int> expected = BruteForceValues(items, query);
+		CHECK(TreeValues(qt, query) == expected);
+		CHECK(qt.Count(query) == expected.size());
+	}
+}
+
+template <typename Handles>
+static std::vector<int> HandleValues(const QuadTree<int>& qt, const Handles& handles)
+{
+	std::vector<int> values;
+
+	for (const ItemHandle& handle : handles)
+	{
+		values.push_back(qt.Get(handle)->item_);
+	}
+
+	std::sort(values.begin(), values.end());
+	return values;
+}
+
+static Circle<float> RandomCircle(std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> position(-64.0f, world.width_ + 64.0f);
+	std::uniform_real_distribution<float> radius(1.0f, 200.0f);
+	return Circle<float>(position(rng), position(rng), radius(rng));
+}
+
+static void InsertAll(QuadTree<int>* qt, const Items& items)
+{
+	for (const auto& [item, item_bbox] : items)
+	{
+		qt->Insert(item, item_bbox);
+	}
+}
+
+static std::string TempPath(const char* name)
+{
+	return (std::filesystem::temp_directory_path() / name).string();
+}
+
+static std::string ReadFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::stringstream contents;
+	contents << file.rdbuf();
+	return contents.str();
+}
+
+static std::size_t Occurrences(const std::string& text, const std::string& pattern)
+{
+	std::size_t count = 0;
+
+	for (std::size_t at = text.find(pattern); at != std::string::npos; at = text.find(pattern, at + 1))
+	{
+		++count;
+	}
+
+	return count;
+}
+
+static std::vector<ItemHandle> AllHandles(QuadTree<int>& qt)
+{
+	std::vector<ItemHandle> handles;
+	qt.Search(Rect<float>(world.top_left_.x_ - world.width_, world.top_left_.y_ - world.height_, 3.0f * world.width_, 3.0f * world.height_), &handles);
+	return handles;
+}
+
+// Emptying a split subtree collapses it; the collapsed node must not stay behind as an empty leaf.
+static void TestRemoveFreesCollapsedSubtree()
+{
+	QuadTree<int> qt(Rect<float>(0.0f, 0.0f, 64.0f, 64.0f), QuadTreeConfig{ 6, 2, 0 });
+	std::vector<QuadTree<int>::ItemHandle> corner;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		corner.push_back(qt.Insert(i, Rect<float>(1.0f + i, 1.0f, 1.0f, 1.0f)));
+	}
+
+	qt.Insert(3, Rect<float>(50.0f, 50.0f, 1.0f, 1.0f));
+
+	for (const QuadTree<int>::ItemHandle& handle : corner)
+	{
+		CHECK(qt.Remove(handle));
+	}
+
+	const std::size_t node_count = NodeCount(qt);
+	qt.CleanUp();
+	CHECK(node_count == NodeCount(qt));
+	CHECK(qt.Size() == 1);
+}
+
+// Same for a subtree emptied by moving its items out.
+static void TestRelocateFreesCollapsedSubtree()
+{
+	QuadTree<int> qt(Rect<float>(0.0f, 0.0f, 64.0f, 64.0f), QuadTreeConfig{ 6, 2, 0 });
+	std::vector<QuadTree<int>::ItemHandle> corner;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		corner.push_back(qt.Insert(i, Rect<float>(1.0f + i, 1.0f, 1.0f, 1.0f)));
+	}
+
+	qt.Insert(3, Rect<float>(50.0f, 50.0f, 1.0f, 1.0f));
+
+	for (const QuadTree<int>::ItemHandle& handle : corner)
+	{
+		CHECK(qt.Relocate(handle, Rect<float>(52.0f, 52.0f, 1.0f, 1.0f)));
+	}
+
+	const std::size_t node_count = NodeCount(qt);
+	qt.CleanUp();
+	CHECK(node_count == NodeCount(qt));
+	CHECK(qt.Size() == 4);
+}
+
+// With deferred cleanup, an item moving back and forth across a cell boundary empties the same cells
+// every time; each must wait in the queue once, not once per move.
+static void TestDeferredCleanupQueuesCellOnce()
+{
+	QuadTreeConfig config{ 6, 0, 0 };
+	config.deferred_cleanup_ = true;
+	QuadTree<int> qt(Rect<float>(0.0f, 0.0f, 64.0f, 64.0f), config);
+	qt.Insert(0, Rect<float>(50.0f, 50.0f, 1.0f, 1.0f));
+	const ItemHandle handle = qt.Insert(1, Rect<float>(1.0f, 1.0f, 1.0f, 1.0f));
+
+	for (int i = 0; i < 1000; ++i)
+	{
+		CHECK(qt.Relocate(handle, Rect<float>(i % 2 == 0 ? 17.0f : 1.0f, 1.0f, 1.0f, 1.0f)));
+	}
+
+	CHECK(qt.Compact(0) <= 2);
+	CHECK(qt.Compact(1000) == 0);
+	const std::size_t node_count = NodeCount(qt);
+	qt.CleanUp();
+	CHECK(node_count == NodeCount(qt));
+	CHECK(qt.Size() == 2);
+}
+
+// Subtrees built by a parallel bulk load have their own memory resource. Loading and emptying the
+// tree over and over must reuse those rather than pile up new ones.
+static void TestParallelBulkLoadMemoryBounded()
+{
+	CountingResource counting;
+	std::pmr::memory_resource* previous = std::pmr::set_default_resource(&counting);
+
+	{
+		ThreadPool pool(8);
+		std::mt19937 rng(13);
+		QuadTree<int> qt(world, QuadTreeConfig{ 8, 8, 2 });
+		std::size_t settled_bytes = 0;
+
+		for (int cycle = 0; cycle < 40; ++cycle)
+		{
+			qt.InsertBulk(RandomItems(20000, rng), &pool);
+
+			for (const ItemHandle& handle : AllHandles(qt))
+			{
+				qt.Remove(handle);
+			}
+
+			CHECK(qt.Empty());
+
+			if (cycle == 4)
+			{
+				settled_bytes = counting.live_bytes_.load();
+			}
+		}
+
+		CHECK(counting.live_bytes_.load() <= settled_bytes);
+	}
+
+	std::pmr::set_default_resource(previous);
+}
+
+// A pooled bulk load has to give the same results as inserting one by one, whether it builds an empty
+// tree, adds to one it built before or adds to one grown by Insert, and the tree has to empty and
+// load again cleanly.
+static void TestParallelBulkLoadMatchesInsert()
+{
+	ThreadPool pool(8);
+	const QuadTreeConfig configs[] = { QuadTreeConfig{ 6, 0, 0 }, QuadTreeConfig{ 8, 8, 2 }, QuadTreeConfig{ 8, 4, 1, 2.0f } };
+
+	for (const QuadTreeConfig& config : configs)
+	{
+		std::mt19937 rng(131);
+		const Items first = RandomItems(6000, rng);
+		const Items second = RandomItems(6000, rng, 6000);
+		Items both = first;
+		both.insert(both.end(), second.begin(), second.end());
+
+		QuadTree<int> inserted(world, config);
+		QuadTree<int> bulk(world, config);
+		QuadTree<int> mixed(world, config);
+
+		for (const auto& [item, item_bbox] : first)
+		{
+			inserted.Insert(item, item_bbox);
+			mixed.Insert(item, item_bbox);
+		}
+
+		bulk.InsertBulk(first, &pool);
+		CheckQueries(bulk, first, rng);
+
+		for (const auto& [item, item_bbox] : second)
+		{
+			inserted.Insert(item, item_bbox);
+		}
+
+		bulk.InsertBulk(second, &pool);
+		mixed.InsertBulk(second, &pool);
+		CheckQueries(inserted, both, rng);
+		CheckQueries(bulk, both, rng);
+		CheckQueries(mixed, both, rng);
+
+		for (int i = 0; i < 20; ++i)
+		{
+			const Rect<float> query = RandomQuery(rng);
+			CHECK(TreeValues(bulk, query) == TreeValues(inserted, query));
+		}
+
+		for (const ItemHandle& handle : AllHandles(bulk))
+		{
+			CHECK(bulk.Remove(handle));
+		}
+
+		CHECK(bulk.Empty());
+		CHECK(NodeCount(bulk) == 1);
+
+		bulk.InsertBulk(second, &pool);
+		CheckQueries(bulk, second, rng);
+	}
+}
+
+// Query visits exactly the items a scan finds, for rects and circles, and stops as soon as the visitor
+// returns false. Search appends the same items to the caller's vector.
+static void TestQueryMatchesBruteForce()
+{
+	std::mt19937 rng(2);
+	const Items items = RandomItems(3000, rng);
+	QuadTree<int> qt(world, 8);
+	InsertAll(&qt, items);
+	std::vector<ItemHandle> handles;
+
+	CheckQueries(qt, items, rng);
+
+	for (int i = 0; i < 50; ++i)
+	{
+		const Circle<float> circle = RandomCircle(rng);
+		CHECK(TreeValues(qt, circle) == BruteForceValues(items, circle));
+
+		const Rect<float> query = RandomQuery(rng);
+		const std::vector<int> expected = BruteForceValues(items, query);
+		handles.assign(1, qt.GetItems()[0].handle_);
+		qt.Search(query, &handles);
+		CHECK(handles.size() == expected.size() + 1);
+		handles.erase(handles.begin());
+		CHECK(HandleValues(qt, handles) == expected);
+
+		std::size_t visited = 0;
+		const bool completed = qt.Query(query, [&visited](const QuadTree<int>::QuadTreeItem&)
+			{
+				return ++visited < 3;
+			});
+		CHECK(completed == (expected.size() < 3));
+		CHECK(visited == std::min<std::size_t>(expected.size(), 3));
+	}
+}
+
+// Shapes passed through the base class are dispatched to their concrete type and must find the same
+// items: Query, Count and both Search overloads.
+static void TestShapeQueriesMatchBruteForce()
+{
+	std::mt19937 rng(4);
+	const Items items = RandomItems(3000, rng);
+	QuadTree<int> qt(world, 8);
+	InsertAll(&qt, items);
+	std::vector<ItemHandle> handles;
+
+	for (int i = 0; i < 50; ++i)
+	{
+		std::unique_ptr<Shape<float>> shape;
+
+		if (i % 2 == 0)
+		{
+			shape = std::make_unique<Rect<float>>(RandomQuery(rng));
+		}
+		else
+		{
+			shape = std::make_unique<Circle<float>>(RandomCircle(rng));
+		}
+
+		const std::vector<int> expected = BruteForceValues(items, *shape);
+		const Shape<float>& base = *shape;
+		CHECK(TreeValues(qt, base) == expected);
+		CHECK(qt.Count(base) == expected.size());
+		CHECK(qt.Count(shape) == expected.size());
+		CHECK(HandleValues(qt, qt.Search(shape)) == expected);
+
+		handles.clear();
+		qt.Search(shape, &handles);
+		CHECK(HandleValues(qt, handles) == expected);
+	}
+
+	CHECK(qt.Count(std::unique_ptr<Shape<float>>()) == 0);
+	CHECK(qt.Search(std::unique_ptr<Shape<float>>()).empty());
+}
+
+// Inserts items, removes two thirds of them and inserts more, checking queries against a scan of the
+// items still in the tree after each step. Returns with two items left in the tree.
+static void CheckChurn(QuadTree<int>* qt, std::mt19937& rng)
+{
+	Items items = RandomItems(3000, rng);
+	std::vector<ItemHandle> handles;
+
+	for (const auto& [item, item_bbox] : items)
+	{
+		handles.push_back(qt->Insert(item, item_bbox));
+	}
+
+	CheckQueries(*qt, items, rng);
+
+	Items kept;
+
+	for (std::size_t i = 0; i < items.size(); ++i)
+	{
+		if (i % 3 == 0)
+		{
+			kept.push_back(items[i]);
+		}
+		else
+		{
+			CHECK(qt->Remove(handles[i]));
+		}
+	}
+
+	CheckQueries(*qt, kept, rng);
+
+	const Items more = RandomItems(2000, rng, 3000);
+	InsertAll(qt, more);
+	kept.insert(kept.end(), more.begin(), more.end());
+	CheckQueries(*qt, kept, rng);
+
+	std::vector<ItemHandle> all = AllHandles(*qt);
+	CHECK(all.size() == kept.size());
+
+	for (std::size_t i = 2; i < all.size(); ++i)
+	{
+		CHECK(qt->Remove(all[i]));
+	}
+
+	CHECK(qt->Size() == 2);
+}
+
+// Nodes split once over capacity and merge back below the threshold; the items must stay findable
+// through both, and a tree down to two items must have merged back into its root.
+static void TestCapacitySplitMergeMatchesBruteForce()
+{
+	std::mt19937 rng(6);
+	QuadTree<int> qt(world, QuadTreeConfig{ 8, 8, 2 });
+	CheckChurn(&qt, rng);
+	CHECK(NodeCount(qt) == 1);
+}
+
+// Loose nodes accept items reaching past their area, so queries have to look into neighbouring cells.
+static void TestLooseTreeMatchesBruteForce()
+{
+	std::mt19937 rng(7);
+	QuadTree<int> loose(world, QuadTreeConfig{ 8, 0, 0, 2.0f });
+	CheckChurn(&loose, rng);
+
+	QuadTree<int> loose_capacity(world, QuadTreeConfig{ 8, 8, 2, 1.5f });
+	CheckChurn(&loose_capacity, rng);
+	CHECK(NodeCount(loose_capacity) == 1);
+}
+
+// A serial bulk load, through the constructor or into a tree already holding items, must place items
+// where queries find them for every kind of tree.
+static void TestBulkLoadMatchesBruteForce()
+{
+	const QuadTreeConfig configs[] = { QuadTreeConfig{ 8, 0, 0 }, QuadTreeConfig{ 8, 8, 2 }, QuadTreeConfig{ 8, 0, 0, 2.0f } };
+
+	for (const QuadTreeConfig& config : configs)
+	{
+		std::mt19937 rng(8);
+		Items items = RandomItems(4000, rng);
+		QuadTree<int> qt(world, config, items);
+		CheckQueries(qt, items, rng);
+
+		const Items more = RandomItems(4000, rng, 4000);
+		qt.InsertBulk(more);
+		items.insert(items.end(), more.begin(), more.end());
+		CheckQueries(qt, items, rng);
+
+		qt.InsertBulk(Items());
+		CHECK(qt.Size() == items.size());
+	}
+}
+
+// KNearest must return the k smallest item distances a scan finds, nearest first, each belonging to
+// the item it names; ties may come in any order, so distances are compared rather than items.
+static void TestKNearestMatchesBruteForce()
+{
+	std::mt19937 rng(9);
+	const Items items = RandomItems(3000, rng);
+	QuadTree<int> qt(world, QuadTreeConfig{ 8, 8, 2 });
+	InsertAll(&qt, items);
+	std::uniform_real_distribution<float> position(-64.0f, world.width_ + 64.0f);
+	std::uniform_int_distribution<std::size_t> count(1, 40);
+	std::uniform_real_distribution<float> reach(0.0f, 100.0f);
+
+	for (int i = 0; i < 50; ++i)
+	{
+		const Point<float> point(position(rng), position(rng));
+		const std::size_t k = count(rng);
+		const float max_distance = i % 2 == 0 ? std::numeric_limits<float>::infinity() : reach(rng);
+		std::vector<float> distances;
+
+		for (const auto& [item, item_bbox] : items)
+		{
+			const float distance = std::sqrt(item_bbox.GetBounds().DistanceSquared(point.x_, point.y_));
+
+			if (distance <= max_distance)
+			{
+				distances.push_back(distance);
+			}
+		}
+
+		std::sort(distances.begin(), distances.end());
+		distances.resize(std::min(distances.size(), k));
+
+		const std::vector<QuadTree<int>::Neighbor> neighbors = qt.KNearest(point, k, max_distance);
+		CHECK(neighbors.size() == distances.size());
+
+		for (std::size_t n = 0; n < std::min(neighbors.size(), distances.size()); ++n)
+		{
+			CHECK(neighbors[n].distance_ == distances[n]);
+			CHECK(std::sqrt(qt.Get(neighbors[n].handle_)->bbox_.DistanceSquared(point.x_, point.y_)) == neighbors[n].distance_);
+		}
+
+		const std::optional<QuadTree<int>::Neighbor> nearest = qt.Nearest(point, max_distance);
+		CHECK(nearest.has_value() == !distances.empty());
+		CHECK(!nearest.has_value() || nearest->distance_ == distances.front());
+	}
+
+	CHECK(qt.KNearest(Point<float>(10.0f, 10.0f), 0).empty());
+}
+
+// RayCast must report the smallest entry t any item's box gives, and SegmentQuery every item the
+// segment touches, ordered by t.
+static void TestRayQueriesMatchBruteForce()
+{
+	std::mt19937 rng(10);
+	const Items items = RandomItems(3000, rng);
+	QuadTree<int> qt(world, QuadTreeConfig{ 8, 8, 2 });
+	InsertAll(&qt, items);
+	std::uniform_real_distribution<float> position(-64.0f, world.width_ + 64.0f);
+	std::uniform_real_distribution<float> reach(0.0f, 2.0f);
+
+	for (int i = 0; i < 50; ++i)
+	{
+		const Point<float> start(position(rng), position(rng));
+		const Point<float> end(position(rng), i % 5 == 0 ? start.y_ : position(rng));
+		const Point<float> direction = end - start;
+		const float max_t = i % 2 == 0 ? std::numeric_limits<float>::infinity() : reach(rng);
+		std::vector<int> expected;
+		std::optional<float> first_t;
+
+		for (const auto& [item, item_bbox] : items)
+		{
+			float t = 0.0f;
+
+			if (item_bbox.GetBounds().IntersectRay(start.x_, start.y_, direction.x_, direction.y_, 0.0f, 1.0f, &t))
+			{
+				expected.push_back(item);
+			}
+
+			if (item_bbox.GetBounds().IntersectRay(start.x_, start.y_, direction.x_, direction.y_, 0.0f, max_t, &t) && (!first_t.has_value() || t < *first_t))
+			{
+				first_t = t;
+			}
+		}
+
+		std::sort(expected.begin(), expected.end());
+
+		const std::vector<QuadTree<int>::RayHit> hits = qt.SegmentQuery(start, end);
+		std::vector<ItemHandle> handles;
+
+		for (std::size_t h = 0; h < hits.size(); ++h)
+		{
+			handles.push_back(hits[h].handle_);
+			CHECK(h == 0 || hits[h - 1].t_ <= hits[h].t_);
+		}
+
+		CHECK(HandleValues(qt, handles) == expected);
+
+		const std::optional<QuadTree<int>::RayHit> hit = qt.RayCast(start, direction, max_t);
+		CHECK(hit.has_value() == first_t.has_value());
+		CHECK(!hit.has_value() || hit->t_ == *first_t);
+	}
+}
+
+// Every overlapping pair a scan of all pairs finds must be reported exactly once, on the calling thread
+// and on the pool, including pairs split across overlapping loose cells.
+static void TestOverlappingPairsMatchBruteForce()
+{
+	typedef std::pair<int, int> ValuePair;
+
+	ThreadPool pool(8);
+	const QuadTreeConfig configs[] = { QuadTreeConfig{ 8, 0, 0 }, QuadTreeConfig{ 8, 8, 2 }, QuadTreeConfig{ 8, 4, 1, 2.0f } };
+
+	for (const QuadTreeConfig& config : configs)
+	{
+		std::mt19937 rng(11);
+		const Items items = RandomItems(1500, rng);
+		QuadTree<int> qt(world, config);
+		InsertAll(&qt, items);
+		std::vector<ValuePair> expected;
+
+		for (std::size_t i = 0; i < items.size(); ++i)
+		{
+			for (std::size_t j = i + 1; j < items.size(); ++j)
+			{
+				if (items[i].second.GetBounds().Overlaps(items[j].second.GetBounds()))
+				{
+					expected.emplace_back(items[i].first, items[j].first);
+				}
+			}
+		}
+
+		std::sort(expected.begin(), expected.end());
+
+		std::vector<ValuePair> serial;
+		std::vector<ValuePair> parallel;
+		std::mutex parallel_mutex;
+		const auto ordered = [](const QuadTree<int>::QuadTreeItem& a, const QuadTree<int>::QuadTreeItem& b)
+			{
+				return ValuePair(std::min(a.item_, b.item_), std::max(a.item_, b.item_));
+			};
+
+		qt.ForEachOverlappingPair([&serial, &ordered](const QuadTree<int>::QuadTreeItem& a, const QuadTree<int>::QuadTreeItem& b)
+			{
+				serial.push_back(ordered(a, b));
+			});
+		qt.ForEachOverlappingPair([&parallel, &parallel_mutex, &ordered](const QuadTree<int>::QuadTreeItem& a, const QuadTree<int>::QuadTreeItem& b)
+			{
+				std::lock_guard<std::mutex> lock(parallel_mutex);
+				parallel.push_back(ordered(a, b));
+			}, &pool);
+
+		std::sort(serial.begin(), serial.end());
+		std::sort(parallel.begin(), parallel.end());
+		CHECK(!expected.empty());
+		CHECK(serial == expected);
+		CHECK(parallel == expected);
+	}
+}
+
+// Each query of a batch must get the items a scan finds for it, with and without a pool, and a result
+// reused for a smaller batch must not keep matches of the larger one.
+static void TestSearchBatchMatchesBruteForce()
+{
+	std::mt19937 rng(12);
+	const Items items = RandomItems(3000, rng);
+	QuadTree<int> qt(world, 8);
+	InsertAll(&qt, items);
+	ThreadPool pool(8);
+	QuadTree<int>::BatchResult result;
+
+	for (std::size_t batch_size : { 300, 1, 0, 40 })
+	{
+		std::vector<Rect<float>> queries;
+
+		for (std::size_t q = 0; q < batch_size; ++q)
+		{
+			queries.push_back(RandomQuery(rng));
+		}
+
+		for (ThreadPool* batch_pool : { static_cast<ThreadPool*>(nullptr), &pool })
+		{
+			qt.SearchBatch(queries, &result, batch_pool);
+			CHECK(result.Size() == queries.size());
+
+			for (std::size_t q = 0; q < std::min(result.Size(), queries.size()); ++q)
+			{
+				CHECK(HandleValues(qt, result.Matches(q)) == BruteForceValues(items, queries[q]));
+			}
+		}
+
+		std::vector<Circle<float>> circles;
+
+		for (std::size_t q = 0; q < batch_size; ++q)
+		{
+			circles.push_back(RandomCircle(rng));
+		}
+
+		qt.SearchBatch(circles, &result, &pool);
+		CHECK(result.Size() == circles.size());
+
+		for (std::size_t q = 0; q < std::min(result.Size(), circles.size()); ++q)
+		{
+			CHECK(HandleValues(qt, result.Matches(q)) == BruteForceValues(items, circles[q]));
+		}
+	}
+}
+
+// Snapshots must show the tree as of the last Publish while the writer moves on, the writer's copy its
+// latest changes, and handles from Insert must name the same item in both copies. A reader thread
+// checks meanwhile that no snapshot is caught half updated.
+static void TestConcurrentTreeMatchesBruteForce()
+{
+	std::mt19937 rng(14);
+	ConcurrentQuadTree<int> tree(world, QuadTreeConfig{ 8, 8, 2 });
+	const Rect<float> everything(-world.width_, -world.height_, 3.0f * world.width_, 3.0f * world.height_);
+	std::vector<ItemHandle> handles;
+	Items live;
+	Items published;
+	std::atomic<bool> done = false;
+	std::atomic<int> torn_snapshots = 0;
+
+	std::thread reader([&tree, &everything, &done, &torn_snapshots]()
+		{
+			while (!done.load())
+			{
+				const ConcurrentQuadTree<int>::Snapshot snapshot = tree.Read();
+
+				if (snapshot.Tree().Count(everything) != snapshot.Tree().Size())
+				{
+					++torn_snapshots;
+				}
+			}
+		});
+
+	int next_value = 0;
+
+	for (int round = 0; round < 20; ++round)
+	{
+		for (int change = 0; change < 200; ++change)
+		{
+			const std::size_t choice = std::uniform_int_distribution<std::size_t>(0, 2)(rng);
+
+			if (live.empty() || choice == 0)
+			{
+				live.push_back(RandomItems(1, rng, next_value++).front());
+				handles.push_back(tree.Insert(live.back().first, live.back().second));
+				continue;
+			}
+
+			const std::size_t index = std::uniform_int_distribution<std::size_t>(0, live.size() - 1)(rng);
+
+			if (choice == 1)
+			{
+				tree.Remove(handles[index]);
+				live[index] = live.back();
+				live.pop_back();
+				handles[index] = handles.back();
+				handles.pop_back();
+			}
+			else
+			{
+				live[index].second = RandomItems(1, rng).front().second;
+				tree.Relocate(handles[index], live[index].second);
+			}
+		}
+
+		if (round % 5 == 4)
+		{
+			tree.CleanUp();
+		}
+
+		{
+			const ConcurrentQuadTree<int>::Snapshot snapshot = tree.Read();
+			CheckQueries(snapshot.Tree(), published, rng);
+		}
+
+		CheckQueries(tree.WriterTree(), live, rng);
+		tree.Publish();
+		published = live;
+
+		const ConcurrentQuadTree<int>::Snapshot snapshot = tree.Read();
+		CheckQueries(snapshot.Tree(), live, rng);
+
+		for (std::size_t i = 0; i < handles.size(); ++i)
+		{
+			CHECK(snapshot.Tree().Get(handles[i]) != nullptr && snapshot.Tree().Get(handles[i])->item_ == live[i].first);
+		}
+	}
+
+	done = true;
+	reader.join();
+	CHECK(torn_snapshots.load() == 0);
+}
+
+// Commands posted from several threads must leave the tree as applying them one by one would: every
+// insert reported with its tag, an item's last move winning, a removal beating any move, and commands
+// on handles gone stale dropped.
+static void TestCommandQueueMatchesBruteForce()
+{
+	const int producer_count = 4;
+	const int per_producer = 500;
+	std::mt19937 rng(15);
+	const Items items = RandomItems(producer_count * per_producer, rng);
+	const Items moves[2] = { RandomItems(items.size(), rng), RandomItems(items.size(), rng) };
+	QuadTree<int> qt(world, QuadTreeConfig{ 8, 8, 2 });
+	CommandQueue<int> queue(1 << 13);
+	std::vector<std::thread> producers;
+
+	for (int producer = 0; producer < producer_count; ++producer)
+	{
+		producers.emplace_back([&queue, &items, producer]()
+			{
+				for (int i = producer * per_producer; i < (producer + 1) * per_producer; ++i)
+				{
+					while (!queue.Insert(items[i].first, items[i].second, static_cast<std::uint64_t>(items[i].first)))
+					{
+						std::this_thread::yield();
+					}
+				}
+			});
+	}
+
+	for (std::thread& producer : producers)
+	{
+		producer.join();
+	}
+
+	std::vector<CommandQueue<int>::InsertedItem> inserted;
+	CHECK(queue.Apply(&qt, &inserted) == items.size());
+	CHECK(inserted.size() == items.size());
+	CheckQueries(qt, items, rng);
+
+	std::vector<ItemHandle> handles(items.size());
+
+	for (const auto& [tag, handle] : inserted)
+	{
+		CHECK(qt.Get(handle) != nullptr && static_cast<std::uint64_t>(qt.Get(handle)->item_) == tag);
+		handles[tag] = handle;
+	}
+
+	// Each producer owns the items with its index modulo producer_count, so their commands keep order.
+	producers.clear();
+	std::atomic<int> rejected = 0;
+
+	for (int producer = 0; producer < producer_count; ++producer)
+	{
+		producers.emplace_back([&queue, &handles, &moves, &rejected, producer]()
+			{
+				for (std::size_t i = producer; i < handles.size(); i += producer_count)
+				{
+					const bool posted = (i % 5 != 0 || queue.Remove(handles[i])) && queue.Relocate(handles[i], moves[0][i].second) &&
+						queue.Relocate(handles[i], moves[1][i].second) && (i % 3 != 0 || queue.Remove(handles[i]));
+
+					if (!posted)
+					{
+						++rejected;
+					}
+				}
+			});
+	}
+
+	for (std::thread& producer : producers)
+	{
+		producer.join();
+	}
+
+	CHECK(rejected.load() == 0);
+	queue.Apply(&qt);
+
+	Items expected;
+
+	for (std::size_t i = 0; i < items.size(); ++i)
+	{
+		if (i % 5 != 0 && i % 3 != 0)
+		{
+			expected.emplace_back(items[i].first, moves[1][i].second);
+		}
+	}
+
+	CheckQueries(qt, expected, rng);
+
+	for (std::size_t i = 0; i < items.size(); i += 3)
+	{
+		CHECK(queue.Relocate(handles[i], moves[0][i].second));
+	}
+
+	CHECK(queue.Insert(-1, Rect<float>(10.0f, 10.0f, 5.0f, 5.0f)));
+	inserted.clear();
+	queue.Apply(&qt, &inserted);
+	CHECK(inserted.size() == 1 && inserted.front().first == 0);
+	expected.emplace_back(-1, Rect<float>(10.0f, 10.0f, 5.0f, 5.0f));
+	CheckQueries(qt, expected, rng);
+}
+
+// Empty nodes left queued by deferred cleanup must not hide items from queries, and compacting in
+// small steps must end with the same nodes as an immediate cleanup.
+static void TestDeferredCleanupMatchesBruteForce()
+{
+	std::mt19937 rng(16);
+	QuadTreeConfig config{ 8, 0, 0 };
+	config.deferred_cleanup_ = true;
+	QuadTree<int> qt(world, config);
+	CheckChurn(&qt, rng);
+
+	while (qt.Compact(16) != 0)
+	{
+	}
+
+	const std::size_t node_count = NodeCount(qt);
+	qt.CleanUp();
+	CHECK(node_count == NodeCount(qt));
+	CHECK(node_count <= 2 * config.max_depth_ + 1);
+}
+
+// Items moving a little each tick, one by one or in batches that move some items twice and include
+// a stale handle, must be found where they ended up, and leave no empty nodes behind.
+static void TestRelocateMatchesBruteForce()
+{
+	const QuadTreeConfig configs[] = { QuadTreeConfig{ 8, 0, 0 }, QuadTreeConfig{ 8, 8, 2 }, QuadTreeConfig{ 8, 4, 1, 2.0f } };
+
+	for (const QuadTreeConfig& config : configs)
+	{
+		std::mt19937 rng(17);
+		Items items = RandomItems(3000, rng);
+		QuadTree<int> qt(world, config);
+		std::vector<ItemHandle> handles;
+		std::uniform_real_distribution<float> step(-40.0f, 40.0f);
+
+		for (const auto& [item, item_bbox] : items)
+		{
+			handles.push_back(qt.Insert(item, item_bbox));
+		}
+
+		const ItemHandle stale = handles.back();
+		CHECK(qt.Remove(stale));
+		items.pop_back();
+		handles.pop_back();
+
+		for (int tick = 0; tick < 10; ++tick)
+		{
+			std::vector<std::pair<ItemHandle, Rect<float>>> moves;
+
+			for (std::size_t i = 0; i < items.size(); ++i)
+			{
+				Rect<float>& item_bbox = items[i].second;
+				const Rect<float> moved(std::clamp(item_bbox.top_left_.x_ + step(rng), 0.0f, world.width_ - 1.0f), 
+					std::clamp(item_bbox.top_left_.y_ + step(rng), 0.0f, world.height_ - 1.0f), item_bbox.width_, item_bbox.height_);
+
+				if (tick % 2 == 0)
+				{
+					CHECK(qt.Relocate(handles[i], moved));
+				}
+				else
+				{
+					if (i % 7 == 0)
+					{
+						moves.emplace_back(handles[i], Rect<float>(0.0f, 0.0f, 1.0f, 1.0f));
+					}
+
+					moves.emplace_back(handles[i], moved);
+				}
+
+				item_bbox = moved;
+			}
+
+			moves.emplace_back(stale, Rect<float>(0.0f, 0.0f, 1.0f, 1.0f));
+			qt.RelocateMany(moves);
+			CHECK(!qt.Relocate(stale, Rect<float>(0.0f, 0.0f, 1.0f, 1.0f)));
+			CheckQueries(qt, items, rng);
+		}
+
+		const std::size_t node_count = NodeCount(qt);
+		qt.CleanUp();
+		CHECK(node_count == NodeCount(qt));
+	}
+}
+
+// Handles stay valid while other items come and go, and a removed item's handle stays dead even after
+// its slot has been reused, so Get, Contains, Remove and Relocate on it all fail.
+static void TestHandlesSurviveChurn()
+{
+	std::mt19937 rng(18);
+	const Items items = RandomItems(2000, rng);
+	QuadTree<int> qt(world, QuadTreeConfig{ 8, 8, 2 });
+	std::vector<ItemHandle> handles;
+
+	for (const auto& [item, item_bbox] : items)
+	{
+		handles.push_back(qt.Insert(item, item_bbox));
+	}
+
+	std::vector<ItemHandle> removed;
+
+	for (std::size_t i = 0; i < handles.size(); i += 2)
+	{
+		CHECK(qt.Remove(handles[i]));
+		removed.push_back(handles[i]);
+	}
+
+	Items expected;
+
+	for (std::size_t i = 1; i < items.size(); i += 2)
+	{
+		expected.push_back(items[i]);
+	}
+
+	const Items refill = RandomItems(removed.size(), rng, static_cast<int>(items.size()));
+
+	for (const auto& [item, item_bbox] : refill)
+	{
+		const ItemHandle handle = qt.Insert(item, item_bbox);
+		CHECK(qt.Get(handle) != nullptr && qt.Get(handle)->item_ == item);
+		CHECK(std::find(removed.begin(), removed.end(), handle) == removed.end());
+	}
+
+	expected.insert(expected.end(), refill.begin(), refill.end());
+
+	for (const ItemHandle& handle : removed)
+	{
+		CHECK(!qt.Contains(handle));
+		CHECK(qt.Get(handle) == nullptr);
+		CHECK(!qt.Remove(handle));
+		CHECK(!qt.Relocate(handle, Rect<float>(0.0f, 0.0f, 1.0f, 1.0f)));
+	}
+
+	for (std::size_t i = 1; i < handles.size(); i += 2)
+	{
+		CHECK(qt.Contains(handles[i]));
+		CHECK(qt.Get(handles[i]) != nullptr && qt.Get(handles[i])->item_ == items[i].first);
+		CHECK(qt.Get(handles[i]) != nullptr && qt.Get(handles[i])->handle_ == handles[i]);
+	}
+
+	CHECK(!qt.Contains(ItemHandle()));
+	CheckQueries(qt, expected, rng);
+}
+
+// Count takes whole subtrees from their item counts when the area covers them, so it is checked with
+// areas large enough to cover many nodes, and after removals have changed those counts.
+static void TestCountMatchesBruteForce()
+{
+	const QuadTreeConfig configs[] = { QuadTreeConfig{ 8, 0, 0 }, QuadTreeConfig{ 8, 8, 2 }, QuadTreeConfig{ 8, 0, 0, 2.0f } };
+
+	for (const QuadTreeConfig& config : configs)
+	{
+		std::mt19937 rng(19);
+		Items items = RandomItems(4000, rng);
+		QuadTree<int> qt(world, config);
+		std::vector<ItemHandle> handles;
+		std::uniform_real_distribution<float> position(-64.0f, world.width_);
+		std::uniform_real_distribution<float> side(100.0f, 900.0f);
+
+		for (const auto& [item, item_bbox] : items)
+		{
+			handles.push_back(qt.Insert(item, item_bbox));
+		}
+
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			for (int i = 0; i < 50; ++i)
+			{
+				const Rect<float> query(position(rng), position(rng), side(rng), side(rng));
+				CHECK(qt.Count(query) == BruteForceValues(items, query).size());
+
+				const Circle<float> circle(position(rng), position(rng), side(rng) / 2.0f);
+				CHECK(qt.Count(circle) == BruteForceValues(items, circle).size());
+			}
+
+			CHECK(qt.Count(Rect<float>(-1.0f, -1.0f, 2.0f * world.width_, 2.0f * world.height_)) == items.size());
+
+			for (std::size_t i = items.size(); i-- > 0;)
+			{
+				if (i % 3 != 0)
+				{
+					CHECK(qt.Remove(handles[i]));
+					items.erase(items.begin() + i);
+					handles.erase(handles.begin() + i);
+				}
+			}
+		}
+	}
+}
+
+// Iterating SearchLazy to the end must yield what a scan finds, and taking only the first few matches
+// must yield that many of them.
+static void TestSearchLazyMatchesBruteForce()
+{
+	std::mt19937 rng(20);
+	const Items items = RandomItems(3000, rng);
+	QuadTree<int> qt(world, QuadTreeConfig{ 8, 8, 2 });
+	InsertAll(&qt, items);
+
+	for (int i = 0; i < 50; ++i)
+	{
+		const Rect<float> query = RandomQuery(rng);
+		const std::vector<int> expected = BruteForceValues(items, query);
+		std::vector<int> values;
+
+		for (const QuadTree<int>::QuadTreeItem& qt_item : qt.SearchLazy(query))
+		{
+			values.push_back(qt_item.item_);
+		}
+
+		std::sort(values.begin(), values.end());
+		CHECK(values == expected);
+
+		std::vector<int> first;
+
+		for (const QuadTree<int>::QuadTreeItem& qt_item : qt.SearchLazy(query) | std::views::take(3))
+		{
+			first.push_back(qt_item.item_);
+		}
+
+		CHECK(first.size() == std::min<std::size_t>(expected.size(), 3));
+
+		for (int value : first)
+		{
+			CHECK(std::binary_search(expected.begin(), expected.end(), value));
+		}
+
+		const Circle<float> circle = RandomCircle(rng);
+		values.clear();
+
+		for (const QuadTree<int>::QuadTreeItem& qt_item : qt.SearchLazy(circle))
+		{
+			values.push_back(qt_item.item_);
+		}
+
+		std::sort(values.begin(), values.end());
+		CHECK(values == BruteForceValues(items, circle));
+	}
+}
+
+// Depth an item sinks to in a tight tree without capacity: the deepest whose cell contains its box.
+static std::size_t BruteForceDepth(const Rect<float>& item_bbox, std::size_t max_depth)
+{
+	const AABB<float> box = item_bbox.GetBounds();
+	std::size_t depth = 0;
+	float side = world.width_;
+
+	if (!world.GetBounds().Contains(box))
+	{
+		return 0;
+	}
+
+	while (depth < max_depth)
+	{
+		side /= 2.0f;
+
+		if (std::floor(box.min_x_ / side) != std::floor(box.max_x_ / side) || std::floor(box.min_y_ / side) != std::floor(box.max_y_ / side))
+		{
+			break;
+		}
+
+		++depth;
+	}
+
+	return depth;
+}
+
+// The per-depth item counts must match the depths a scan computes for every item, and the totals must
+// agree with each other, with the tree and with the JSON export.
+static void TestStatsMatchBruteForce()
+{
+	std::mt19937 rng(22);
+	const Items items = RandomItems(3000, rng);
+	QuadTree<int> qt(world, 6);
+	InsertAll(&qt, items);
+	std::vector<std::size_t> items_per_depth;
+
+	for (const auto& [item, item_bbox] : items)
+	{
+		const std::size_t depth = BruteForceDepth(item_bbox, 6);
+		items_per_depth.resize(std::max(items_per_depth.size(), depth + 1), 0);
+		++items_per_depth[depth];
+	}
+
+	const quadtree_stats::TreeStats stats = qt.GetStats();
+	CHECK(stats.item_count_ == items.size());
+	CHECK(stats.items_per_depth_ == items_per_depth);
+	CHECK(stats.root_items_ == items_per_depth[0]);
+	CHECK(stats.root_items_ + stats.straddling_items_ <= stats.item_count_);
+	CHECK(!stats.nodes_per_depth_.empty() && stats.nodes_per_depth_[0] == 1);
+
+	std::size_t node_count = 0;
+
+	for (std::size_t nodes : stats.nodes_per_depth_)
+	{
+		node_count += nodes;
+	}
+
+	CHECK(node_count == stats.node_count_);
+
+	const std::string json = quadtree_stats::ToJson(stats);
+	CHECK(json.find("\"node_count\":" + std::to_string(stats.node_count_) + ",") != std::string::npos);
+	CHECK(json.find("\"items_per_depth\":" + quadtree_stats::ToJson(items_per_depth) + "}") != std::string::npos);
+}
+
+// The trace must hold one complete event per scope timed while tracing, nested ones included, and
+// none of the scopes timed before or after.
+static void TestFrameProfilerTrace()
+{
+	const std::string path = TempPath("quadtree_tests_trace.json");
+	FrameProfiler profiler;
+
+	{
+		FrameProfiler::Scope scope(&profiler, "before");
+	}
+
+	profiler.StartTrace(path);
+	CHECK(profiler.Tracing());
+
+	for (int frame = 0; frame < 3; ++frame)
+	{
+		FrameProfiler::Scope frame_scope(&profiler, "frame");
+
+		for (int i = 0; i < 2; ++i)
+		{
+			FrameProfiler::Scope query_scope(&profiler, "query");
+		}
+	}
+
+	profiler.StopTrace();
+	CHECK(!profiler.Tracing());
+
+	{
+		FrameProfiler::Scope scope(&profiler, "after");
+	}
+
+	profiler.StopTrace();
+	profiler.Report(false);
+
+	const std::string trace = ReadFile(path);
+	CHECK(trace.rfind("{\"traceEvents\":[", 0) == 0);
+	CHECK(trace.size() >= 3 && trace.compare(trace.size() - 3, 3, "]}\n") == 0);
+	CHECK(Occurrences(trace, "\"ph\":\"X\"") == 9);
+	CHECK(Occurrences(trace, "\"name\":\"frame\"") == 3);
+	CHECK(Occurrences(trace, "\"name\":\"query\"") == 6);
+	CHECK(Occurrences(trace, "before") == 0 && Occurrences(trace, "after") == 0);
+	std::filesystem::remove(path);
+}
+
+template <typename AreaType>
+static std::vector<int> MappedValues(const MappedQuadTree<int>& mapped, const AreaType& area)
+{
+	std::vector<int> values;
+	mapped.Query(area, [&values](const MappedQuadTree<int>::Item& item)
+		{
+			values.push_back(item.item_);
+		});
+	std::sort(values.begin(), values.end());
+	return values;
+}
+
+// A saved tree, whether mapped read-only or loaded back, must answer queries like a scan of the items
+// it held when saved. Truncated or missing files must be refused.
+static void TestSnapshotMatchesBruteForce()
+{
+	const std::string path = TempPath("quadtree_tests_snapshot.qts");
+	const QuadTreeConfig configs[] = { QuadTreeConfig{ 8, 0, 0 }, QuadTreeConfig{ 8, 8, 2 }, QuadTreeConfig{ 8, 4, 1, 2.0f } };
+
+	for (const QuadTreeConfig& config : configs)
+	{
+		std::mt19937 rng(24);
+		const Items all = RandomItems(3000, rng);
+		QuadTree<int> qt(world, config);
+		Items items;
+
+		for (const auto& [item, item_bbox] : all)
+		{
+			const ItemHandle handle = qt.Insert(item, item_bbox);
+
+			if (item % 4 == 0)
+			{
+				qt.Remove(handle);
+			}
+			else
+			{
+				items.emplace_back(item, item_bbox);
+			}
+		}
+
+		CHECK(qt.Save(path));
+
+		{
+			MappedQuadTree<int> mapped;
+			CHECK(mapped.Open(path));
+			CHECK(mapped.Size() == items.size());
+
+			for (int i = 0; i < 50; ++i)
+			{
+				const Rect<float> query = RandomQuery(rng);
+				const std::vector<int> expected = BruteForceValues(items, query);
+				CHECK(MappedValues(mapped, query) == expected);
+				CHECK(mapped.Count(query) == expected.size());
+
+				const Circle<float> circle = RandomCircle(rng);
+				CHECK(MappedValues(mapped, circle) == BruteForceValues(items, circle));
+			}
+		}
+
+		const std::unique_ptr<QuadTree<int>> loaded = QuadTree<int>::Load(path);
+		CHECK(loaded != nullptr);
+
+		if (loaded != nullptr)
+		{
+			CheckQueries(*loaded, items, rng);
+		}
+	}
+
+	const std::string contents = ReadFile(path);
+	std::ofstream(path, std::ios::binary | std::ios::trunc).write(contents.data(), static_cast<std::streamsize>(contents.size() / 2));
+	MappedQuadTree<int> truncated;
+	CHECK(!truncated.Open(path));
+	CHECK(QuadTree<int>::Load(path) == nullptr);
+
+	std::filesystem::remove(path);
+	CHECK(QuadTree<int>::Load(path) == nullptr);
+}
+
+// Files streamed in chunks small enough to split records, and batches smaller than the file, must load
+// every record once: queries match a scan of the records written, and the last progress report
+// accounts for the whole file and its one bad record.
+static void TestStreamingLoaderMatchesBruteForce()
+{
+	const std::string csv_path = TempPath("quadtree_tests_items.csv");
+	const std::string binary_path = TempPath("quadtree_tests_items.bin");
+	std::mt19937 rng(25);
+	const Items items = RandomItems(5000, rng);
+	ThreadPool pool(4);
+	StreamingLoaderConfig config;
+	config.chunk_bytes_ = 257;
+	config.batch_items_ = 300;
+	config.max_batches_ = 2;
+
+	std::FILE* csv = std::fopen(csv_path.c_str(), "w");
+	std::FILE* binary = std::fopen(binary_path.c_str(), "wb");
+	CHECK(csv != nullptr && binary != nullptr);
+
+	if (csv == nullptr || binary == nullptr)
+	{
+		return;
+	}
+
+	std::fprintf(csv, "%s\n", "x,y,width,height,value");
+
+	for (const auto& [item, item_bbox] : items)
+	{
+		std::fprintf(csv, "%.9g,%.9g,%.9g,%.9g,%d\n", item_bbox.top_left_.x_, item_bbox.top_left_.y_, item_bbox.width_, item_bbox.height_, item);
+		const snapshot::Item<int> record = { item_bbox.GetBounds(), item };
+		std::fwrite(&record, sizeof(record), 1, binary);
+	}
+
+	std::fwrite("bad", 3, 1, binary);
+	std::fclose(csv);
+	std::fclose(binary);
+
+	for (const std::string& path : { csv_path, binary_path })
+	{
+		StreamingLoader<int> loader(config);
+		QuadTree<int> qt(world, QuadTreeConfig{ 8, 8, 2 });
+		LoadProgress last = {};
+		std::size_t reports = 0;
+		const auto progress = [&last, &reports](const LoadProgress& report)
+			{
+				CHECK(report.items_loaded_ >= last.items_loaded_);
+				last = report;
+				++reports;
+			};
+
+		const bool loaded = path == csv_path ? loader.Load<RecordFormat::CSV>(path, &qt, &pool, progress) : 
+			loader.Load<RecordFormat::BINARY>(path, &qt, nullptr, progress);
+		CHECK(loaded);
+		CheckQueries(qt, items, rng);
+		CHECK(reports >= items.size() / config.batch_items_);
+		CHECK(last.items_loaded_ == items.size());
+		CHECK(last.bad_records_ == 1);
+		CHECK(last.bytes_read_ == last.total_bytes_ && last.total_bytes_ == std::filesystem::file_size(path));
+		std::filesystem::remove(path);
+	}
+
+	StreamingLoader<int> loader;
+	QuadTree<int> qt(world, 8);
+	CHECK(!loader.Load<RecordFormat::CSV>(csv_path, &qt));
+	CHECK(qt.Empty());
+}
+
+// Every leaf scan kernel the CPU can run must pick exactly the boxes AABB::Intersects and
+// Circle::Intersects pick, for every count so the vector loops and their scalar tails are both covered.
+// Coordinates on a coarse grid make boxes touch the query edges often.
+static void TestBoxScanKernelsMatchBruteForce()
+{
+	std::vector<box_scan::Kernels> kernels = { { box_scan::ScalarRect, box_scan::ScalarCircle, "scalar" } };
+#ifdef QUADTREE_BOX_SCAN_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse2"))
+	{
+		kernels.push_back({ box_scan::SseRect, box_scan::SseCircle, "sse2" });
+	}
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		kernels.push_back({ box_scan::Avx2Rect, box_scan::Avx2Circle, "avx2" });
+	}
+
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		kernels.push_back({ box_scan::Avx512Rect, box_scan::Avx512Circle, "avx512f" });
+	}
+#endif
+
+	std::mt19937 rng(5);
+	std::uniform_int_distribution<int> grid(0, 32);
+	const std::size_t max_count = 67;
+	std::vector<AABB<float>> boxes;
+	std::vector<float> columns[4];
+
+	for (std::size_t i = 0; i < max_count; ++i)
+	{
+		const float x = static_cast<float>(grid(rng));
+		const float y = static_cast<float>(grid(rng));
+		boxes.push_back({ x, y, x + static_cast<float>(grid(rng) % 8), y + static_cast<float>(grid(rng) % 8) });
+		columns[0].push_back(boxes.back().min_x_);
+		columns[1].push_back(boxes.back().min_y_);
+		columns[2].push_back(boxes.back().max_x_);
+		columns[3].push_back(boxes.back().max_y_);
+	}
+
+	const box_scan::Columns soa = { columns[0].data(), columns[1].data(), columns[2].data(), columns[3].data() };
+	std::vector<std::uint32_t> out(max_count);
+
+	for (int q = 0; q < 200; ++q)
+	{
+		const float x = static_cast<float>(grid(rng));
+		const float y = static_cast<float>(grid(rng));
+		const AABB<float> query = { x, y, x + static_cast<float>(grid(rng) % 12), y + static_cast<float>(grid(rng) % 12) };
+		const Circle<float> circle(x, y, static_cast<float>(grid(rng) % 10));
+
+		for (std::size_t count = 0; count <= max_count; ++count)
+		{
+			std::vector<std::uint32_t> rect_expected;
+			std::vector<std::uint32_t> circle_expected;
+
+			for (std::uint32_t i = 0; i < count; ++i)
+			{
+				if (query.Intersects(boxes[i]))
+				{
+					rect_expected.push_back(i);
+				}
+
+				if (circle.Intersects(boxes[i]))
+				{
+					circle_expected.push_back(i);
+				}
+			}
+
+			for (const box_scan::Kernels& kernel : kernels)
+			{
+				const std::size_t rect_found = kernel.rect_(soa, count, query, out.data());
+				CHECK(std::vector<std::uint32_t>(out.begin(), out.begin() + rect_found) == rect_expected);
+
+				const std::size_t circle_found = kernel.circle_(soa, count, { x, y, circle.radius_ * circle.radius_ }, out.data());
+				CHECK(std::vector<std::uint32_t>(out.begin(), out.begin() + circle_found) == circle_expected);
+			}
+		}
+	}
+}
+
+// Items, nodes and their slots come from the tree's pool: refilling after Reset must reuse its blocks
+// rather than grow, queries must only see the new items and destroying the tree must give everything
+// back. Handles from before a Reset must be stale afterwards.
+static void TestPoolReuseAcrossReset()
+{
+	CountingResource counting;
+	std::pmr::memory_resource* previous = std::pmr::set_default_resource(&counting);
+
+	{
+		std::mt19937 rng(1);
+		QuadTree<int> qt(world, QuadTreeConfig{ 8, 8, 2 });
+		std::size_t settled_bytes = 0;
+		std::vector<ItemHandle> old_handles;
+
+		for (int cycle = 0; cycle < 10; ++cycle)
+		{
+			const Items items = RandomItems(3000, rng);
+
+			for (const ItemHandle& handle : old_handles)
+			{
+				CHECK(!qt.Contains(handle));
+			}
+
+			old_handles.clear();
+
+			for (const auto& [item, item_bbox] : items)
+			{
+				old_handles.push_back(qt.Insert(item, item_bbox));
+			}
+
+			CheckQueries(qt, items, rng);
+
+			if (cycle == 2)
+			{
+				settled_bytes = counting.live_bytes_.load();
+			}
+
+			if (cycle % 2 == 0)
+			{
+				qt.Reset();
+			}
+			else
+			{
+				qt.Resize(world);
+			}
+
+			CHECK(qt.Empty());
+			CHECK(NodeCount(qt) == 1);
+		}
+
+		CHECK(counting.live_bytes_.load() <= settled_bytes);
+	}
+
+	CHECK(counting.live_bytes_.load() == 0);
+	std::pmr::set_default_resource(previous);
+}
+
+// The tree stores AABBs but takes Rects and Circles, so the AABB tests must agree with the shape tests
+// on every edge case; a coarse grid makes boxes share edges and corners often.
+static void TestAABBMatchesShapes()
+{
+	static_assert(std::is_trivially_copyable_v<AABB<float>>);
+
+	std::mt19937 rng(3);
+	std::uniform_int_distribution<int> grid(0, 16);
+
+	for (int i = 0; i < 20000; ++i)
+	{
+		const Rect<float> a(static_cast<float>(grid(rng)), static_cast<float>(grid(rng)), static_cast<float>(grid(rng) % 6), static_cast<float>(grid(rng) % 6));
+		const Rect<float> b(static_cast<float>(grid(rng)), static_cast<float>(grid(rng)), static_cast<float>(grid(rng) % 6), static_cast<float>(grid(rng) % 6));
+		const Circle<float> circle(static_cast<float>(grid(rng)), static_cast<float>(grid(rng)), static_cast<float>(grid(rng) % 6));
+
+		CHECK(a.Intersects(b) == a.GetBounds().Intersects(b.GetBounds()));
+		CHECK(a.Intersects(b) == a.Intersects(b.GetBounds()));
+		CHECK(a.Contains(b) == a.GetBounds().Contains(b.GetBounds()));
+		CHECK(a.Contains(b) == a.Contains(b.GetBounds()));
+		CHECK(circle.Intersects(b) == circle.Intersects(b.GetBounds()));
+		CHECK(circle.Contains(b) == circle.Contains(b.GetBounds()));
+
+		const AABB<float> round_trip = Rect<float>(a.GetBounds()).GetBounds();
+		CHECK(round_trip.min_x_ == a.GetBounds().min_x_ && round_trip.min_y_ == a.GetBounds().min_y_ && 
+			round_trip.max_x_ == a.GetBounds().max_x_ && round_trip.max_y_ == a.GetBounds().max_y_);
+	}
+}
+
+int main()
+{
+	TestQueryMatchesBruteForce();
+	TestShapeQueriesMatchBruteForce();
+	TestCapacitySplitMergeMatchesBruteForce();
+	TestLooseTreeMatchesBruteForce();
+	TestBulkLoadMatchesBruteForce();
+	TestKNearestMatchesBruteForce();
+	TestRayQueriesMatchBruteForce();
+	TestOverlappingPairsMatchBruteForce();
+	TestSearchBatchMatchesBruteForce();
+	TestConcurrentTreeMatchesBruteForce();
+	TestCommandQueueMatchesBruteForce();
+	TestDeferredCleanupMatchesBruteForce();
+	TestRelocateMatchesBruteForce();
+	TestHandlesSurviveChurn();
+	TestCountMatchesBruteForce();
+	TestSearchLazyMatchesBruteForce();
+	TestStatsMatchBruteForce();
+	TestFrameProfilerTrace();
+	TestSnapshotMatchesBruteForce();
+	TestStreamingLoaderMatchesBruteForce();
+	TestBoxScanKernelsMatchBruteForce();
+	TestPoolReuseAcrossReset();
+	TestAABBMatchesShapes();
+	TestRemoveFreesCollapsedSubtree();
+	TestRelocateFreesCollapsedSubtree();
+	TestDeferredCleanupQueuesCellOnce();
+	TestParallelBulkLoadMemoryBounded();
+	TestParallelBulkLoadMatchesInsert();
+
+	if (failures != 0)
+	{
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	printf("%s\n", "All tests passed");
+	return 0;
+}